@@ -0,0 +1,156 @@
+#include "programs.hpp"
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <machine.hpp>
+#include <random>
+
+namespace {
+using namespace bench;
+
+constexpr size_t batch = 64;
+
+compiler::machine empty_machine() {
+    uint halt = op(7);
+    return compiler::machine(word_array(&halt, 1));
+}
+
+/**
+ * @brief Allocates a batch of arrays of the given size, then frees them in
+ * the reverse order, so each identifier and block is reused straight away
+ *
+ */
+void BM_allocate_deallocate(benchmark::State& state) {
+    compiler::machine m = empty_machine();
+    if (state.range(1) != 0 && !m.enable_pointer_ids()) {
+        state.SkipWithError("Pointer identifiers aren't supported");
+        return;
+    }
+    uint size = uint(state.range(0));
+    uint ids[batch];
+    for (auto _ : state) {
+        for (uint& id : ids) {
+            id = m.allocate(size);
+        }
+        benchmark::DoNotOptimize(ids);
+        for (size_t i = batch; i-- > 0;) {
+            m.deallocate(ids[i]);
+        }
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * batch);
+}
+
+/**
+ * @brief Keeps a pool of live arrays of the given size, and frees and
+ * replaces them in a shuffled order, so that the free list doesn't line up
+ * with the order arrays were allocated in. The pool is smaller for large
+ * arrays, so that it stays within 64MB where it can
+ *
+ */
+void BM_allocate_deallocate_shuffled(benchmark::State& state) {
+    compiler::machine m = empty_machine();
+    if (state.range(1) != 0 && !m.enable_pointer_ids()) {
+        state.SkipWithError("Pointer identifiers aren't supported");
+        return;
+    }
+    uint size = uint(state.range(0));
+    size_t pool = std::clamp<size_t>(
+        (size_t(64) << 20) / (size_t(size) * 4 + 1),
+        batch,
+        4096);
+    std::vector<uint> live(pool);
+    for (uint& id : live) {
+        id = m.allocate(size);
+    }
+    std::vector<size_t> order(live.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), std::mt19937(1));
+    size_t next = 0;
+    for (auto _ : state) {
+        for (size_t i = 0; i < batch; i++) {
+            uint& id = live[order[next++ % order.size()]];
+            m.deallocate(id);
+            id = m.allocate(size);
+        }
+        benchmark::DoNotOptimize(live.data());
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * batch);
+}
+
+void allocation_args(benchmark::internal::Benchmark* b) {
+    for (int64_t pointer_ids : {0, 1}) {
+        for (int64_t size : {1, 4, 16, 256, 4096, 1 << 16, 1 << 20}) {
+            b->Args({size, pointer_ids});
+        }
+    }
+    b->ArgNames({"size", "pointer_ids"});
+}
+
+/**
+ * @brief Allocates a large array, writes one word in every 64KB of it, and
+ * frees it, like a program that allocates scratch space it mostly doesn't
+ * use. Only the pages that are written to should cost anything
+ *
+ */
+void BM_allocate_large_sparse(benchmark::State& state) {
+    compiler::machine m = empty_machine();
+    uint size = uint(state.range(0));
+    for (auto _ : state) {
+        uint id = m.allocate(size);
+        for (uint i = 0; i < size; i += 16 << 10) {
+            m.store(id, i, i);
+        }
+        m.deallocate(id);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()));
+}
+
+/**
+ * @brief Cost of op 12 loading another array into array 0, which shares its
+ * storage. Two different arrays are loaded in turn, so that every load
+ * replaces the program. Items are words loaded
+ *
+ */
+void BM_load_program(benchmark::State& state) {
+    compiler::machine m = empty_machine();
+    uint size = uint(state.range(0));
+    uint arrays[2] {m.allocate(size), m.allocate(size)};
+    for (uint i = 0; i < size; i++) {
+        m.store(arrays[0], i, op(i % 14, 1, 2, 3));
+        m.store(arrays[1], i, op((i + 1) % 14, 1, 2, 3));
+    }
+    size_t turn = 0;
+    for (auto _ : state) {
+        m.load_program(arrays[turn++ & 1]);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * size);
+}
+
+/**
+ * @brief Cost of a store into array 0 after it's been loaded from another
+ * array, which copies the storage the two were sharing
+ *
+ */
+void BM_load_program_then_store(benchmark::State& state) {
+    compiler::machine m = empty_machine();
+    uint size = uint(state.range(0));
+    uint arrays[2] {m.allocate(size), m.allocate(size)};
+    size_t turn = 0;
+    for (auto _ : state) {
+        m.load_program(arrays[turn++ & 1]);
+        m.store(0, 0, op(13));
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * size);
+}
+} // namespace
+
+BENCHMARK(BM_allocate_deallocate)->Apply(allocation_args);
+BENCHMARK(BM_allocate_deallocate_shuffled)->Apply(allocation_args);
+BENCHMARK(BM_allocate_large_sparse)
+    ->RangeMultiplier(8)
+    ->Range(1 << 16, 1 << 27);
+BENCHMARK(BM_load_program)->RangeMultiplier(8)->Range(8, 1 << 21);
+BENCHMARK(BM_load_program_then_store)->RangeMultiplier(8)->Range(8, 1 << 21);
+
+BENCHMARK_MAIN();
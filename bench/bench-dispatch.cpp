@@ -0,0 +1,75 @@
+#include "programs.hpp"
+#include <benchmark/benchmark.h>
+#include <engine.hpp>
+#include <string>
+
+namespace {
+using namespace bench;
+
+constexpr uint copies = 256;
+constexpr uint iterations = 1000;
+
+struct op_case {
+    char const* name;
+    // The number of instructions in each copy of the body
+    uint length;
+    body_builder body;
+};
+
+std::vector<op_case> op_cases() {
+    return {
+        {"cmov", 1, repeat({op(0, 3, 2, 2)})},
+        {"load", 1, repeat({op(1, 3, 1, 2)})},
+        {"store", 1, repeat({op(2, 1, 2, 3)})},
+        {"store-program", 1, repeat({op(2, 0, 2, 3)})},
+        {"add", 1, repeat({op(3, 3, 3, 2)})},
+        {"mul", 1, repeat({op(4, 3, 3, 2)})},
+        {"div", 1, repeat({op(5, 3, 3, 2)})},
+        {"nand", 1, repeat({op(6, 3, 3, 2)})},
+        {"alloc-free", 2, repeat({op(8, 0, 3, 2), op(9, 0, 0, 3)})},
+        {"load-value", 1, repeat({load_value(3, 12345)})},
+        // Jumps to the next instruction
+        {"jump",
+         2,
+         [](assembler& a) {
+             a.load_value(3, a.position() + 2);
+             a.load_program(0, 3);
+         }},
+    };
+}
+
+/**
+ * @brief Runs a loop over copies of a single kind of instruction with the
+ * given engine. Items are instructions in the body of the loop
+ *
+ */
+void run_op(benchmark::State& state, compiler::engine kind, op_case c) {
+    word_array program = loop_program(c.body, copies, iterations);
+    for (auto _ : state) {
+        compiler::machine m(program);
+        compiler::run(m, kind);
+    }
+    state.SetItemsProcessed(
+        int64_t(state.iterations()) * copies * iterations * c.length);
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    for (compiler::engine_info const& info : compiler::engines) {
+        if (!info.available) {
+            continue;
+        }
+        for (op_case const& c : op_cases()) {
+            std::string name = "dispatch/" + std::string(info.name) + "/"
+                             + c.name;
+            benchmark::RegisterBenchmark(name.c_str(), run_op, info.kind, c)
+                ->Unit(benchmark::kMillisecond);
+        }
+    }
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+}
@@ -0,0 +1,86 @@
+#include "programs.hpp"
+#include <benchmark/benchmark.h>
+#include <cstring>
+#include <engine.hpp>
+#include <io.hpp>
+#include <memory>
+
+namespace {
+using namespace bench;
+
+constexpr uint copies = 256;
+constexpr uint iterations = 1000;
+
+// Input that never runs out
+class endless_source : public compiler::input_source {
+   public:
+    size_t read(char* data, size_t size) override {
+        std::memset(data, 'x', size);
+        return size;
+    }
+};
+
+enum class console_kind { buffered, unbuffered, threaded };
+
+compiler::console make_console(console_kind kind) {
+    auto sink = std::make_shared<compiler::null_sink>();
+    auto source = std::make_shared<endless_source>();
+    switch (kind) {
+        case console_kind::buffered: return compiler::console(sink, source);
+        case console_kind::unbuffered:
+            // The same settings as console::compatible()
+            return compiler::console(
+                sink,
+                source,
+                compiler::console_options {
+                    1,
+                    1,
+                    compiler::console_options::clock::duration::zero(),
+                    1});
+        case console_kind::threaded:
+            return compiler::console(
+                std::make_shared<compiler::threaded_sink>(sink),
+                source);
+    }
+    return compiler::console(sink, source);
+}
+
+/**
+ * @brief Runs a loop over copies of a single I/O instruction with the default
+ * engine. Items are bytes written or read
+ *
+ */
+void run_io(benchmark::State& state, uint instruction, console_kind kind) {
+    word_array program = loop_program(
+        repeat({instruction}),
+        copies,
+        iterations,
+        {load_value(3, 'x')});
+    for (auto _ : state) {
+        compiler::machine m(program);
+        m.set_console(make_console(kind));
+        compiler::run(m, compiler::default_engine);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * copies * iterations);
+}
+
+void BM_output(benchmark::State& state, console_kind kind) {
+    run_io(state, op(10, 0, 0, 3), kind);
+}
+void BM_input(benchmark::State& state, console_kind kind) {
+    run_io(state, op(11, 0, 0, 3), kind);
+}
+} // namespace
+
+BENCHMARK_CAPTURE(BM_output, buffered, console_kind::buffered)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_output, unbuffered, console_kind::unbuffered)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_output, threaded, console_kind::threaded)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_input, buffered, console_kind::buffered)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_input, unbuffered, console_kind::unbuffered)
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
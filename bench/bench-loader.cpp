@@ -0,0 +1,87 @@
+#include <benchmark/benchmark.h>
+#include <files.hpp>
+#include <map>
+#include <random>
+
+namespace {
+namespace fs = std::filesystem;
+
+/**
+ * @brief Returns the name of a file of random words with the given size in
+ * bytes, creating it the first time. The files are removed at exit
+ *
+ */
+fs::path program_file(size_t bytes) {
+    struct files {
+        std::map<size_t, fs::path> paths;
+        ~files() {
+            for (auto& [size, path] : paths) {
+                std::error_code ignored;
+                fs::remove(path, ignored);
+            }
+        }
+    };
+    static files cache;
+    auto it = cache.paths.find(bytes);
+    if (it != cache.paths.end()) {
+        return it->second;
+    }
+    fs::path path = fs::temp_directory_path()
+                  / ("bench-loader-" + std::to_string(bytes) + ".um");
+    std::vector<char> contents(bytes);
+    std::mt19937 rng(bytes);
+    for (char& c : contents) {
+        c = char(rng());
+    }
+    std::ofstream(path, std::ios::binary)
+        .write(contents.data(), std::streamsize(contents.size()));
+    cache.paths.emplace(bytes, path);
+    return path;
+}
+
+/**
+ * @brief Reads a program file into a word_array, which is everything
+ * load_from_file does besides decoding the program
+ *
+ */
+void BM_read_program(benchmark::State& state) {
+    fs::path path = program_file(size_t(state.range(0)));
+    for (auto _ : state) {
+        compiler::word_array program = compiler::read_program(path);
+        benchmark::DoNotOptimize(program.data());
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * state.range(0));
+}
+
+void BM_load_from_file(benchmark::State& state) {
+    fs::path path = program_file(size_t(state.range(0)));
+    for (auto _ : state) {
+        compiler::machine m = compiler::load_from_file(path);
+        benchmark::DoNotOptimize(m);
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * state.range(0));
+}
+
+/**
+ * @brief Converts bytes that are already in memory to words, which isolates
+ * the byte swapping from the file system
+ *
+ */
+void BM_read_words_from_bytes(benchmark::State& state) {
+    std::vector<std::byte> bytes = compiler::read_all_bytes(
+        program_file(size_t(state.range(0))));
+    for (auto _ : state) {
+        std::vector<uint32_t> words = compiler::read_words_from_bytes(bytes);
+        benchmark::DoNotOptimize(words.data());
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * state.range(0));
+}
+} // namespace
+
+BENCHMARK(BM_read_program)->RangeMultiplier(16)->Range(1 << 10, 1 << 26);
+BENCHMARK(BM_load_from_file)->RangeMultiplier(16)->Range(1 << 10, 1 << 26);
+BENCHMARK(BM_read_words_from_bytes)
+    ->RangeMultiplier(16)
+    ->Range(1 << 10, 1 << 26);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <assembler.hpp>
+#include <functional>
+#include <vector>
+
+namespace bench {
+using compiler::assembler;
+using compiler::uint;
+using compiler::word_array;
+
+constexpr uint op(uint code, uint a = 0, uint b = 0, uint c = 0) {
+    return assembler::encode(code, a, b, c);
+}
+// Op 13, which loads a value of up to 25 bits into a register
+constexpr uint load_value(uint reg, uint value) {
+    return assembler::encode_load_value(reg, value);
+}
+
+/**
+ * @brief Appends one copy of the body of a loop to the program
+ *
+ */
+using body_builder = std::function<void(assembler&)>;
+
+/**
+ * @brief Assembles a program that runs a loop, with copies of the body laid
+ * out back to back inside it. Before the loop starts, setup runs, and the
+ * registers are set to:
+ *
+ * - r0: 0, so that array 0 can be used as an array
+ * - r1: a scratch array of 16 words
+ * - r2: 3, a safe offset into the scratch array and divisor
+ * - r3: free for the body to use
+ *
+ * The remaining registers belong to the loop. It's about four instructions
+ * per iteration, so with enough copies of the body, nearly all of the time is
+ * spent in the body.
+ *
+ */
+inline word_array loop_program(
+    body_builder const& body,
+    uint copies,
+    uint iterations,
+    std::vector<uint> const& setup = {}) {
+    assembler a;
+    a.load_value(3, 16);
+    a.alloc(1, 3);
+    a.load_value(2, 3);
+    a.nand(5, 0, 0); // r5 = ~0, to count down with
+    a.load_value(6, iterations);
+    a.load_value(3, 0);
+    for (uint word : setup) {
+        a.emit(word);
+    }
+    assembler::label start = a.new_label();
+    assembler::label exit = a.new_label();
+    a.load_label(7, start);
+    a.bind(start);
+    for (uint i = 0; i < copies; i++) {
+        body(a);
+    }
+    a.add(6, 6, 5);
+    a.load_label(4, exit);
+    a.cmov(4, 7, 6); // r4 = start, unless r6 is 0
+    a.load_program(0, 4);
+    a.bind(exit);
+    a.halt();
+    return a.build();
+}
+
+/**
+ * @brief A body consisting of the given instructions
+ *
+ */
+inline body_builder repeat(std::vector<uint> instructions) {
+    return [instructions](assembler& a) {
+        for (uint word : instructions) {
+            a.emit(word);
+        }
+    };
+}
+} // namespace bench
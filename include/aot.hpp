@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <machine.hpp>
+#include <vector>
+
+namespace compiler {
+/**
+ * @brief What programs translated ahead of time into C++ (see translate) need
+ * from the machine. Translated code keeps the registers in local variables,
+ * and goes through the machine for arrays and I/O.
+ *
+ * Translations only hold for the program they were made from. When the
+ * program replaces array 0 or writes into it, the translated code hands its
+ * registers back with resume(), and the rest of the program runs on the
+ * interpreter. Positions that the translation has no label for are run one
+ * instruction at a time with step().
+ *
+ */
+class aot_runtime {
+    machine& m;
+
+   public:
+    using registers = std::array<uint, 8>;
+
+    aot_runtime(machine& m)
+      : m(m) {}
+
+    // Where the machine is, which is where translated code starts
+    uint program_counter() const { return m.program_counter; }
+    registers get_registers() const { return m.registers; }
+    std::vector<uint> program() const {
+        return std::vector<uint>(m.arrays[0].begin(), m.arrays[0].end());
+    }
+    /**
+     * @brief Checks that array 0 holds the given program, which is the one
+     * the code was translated from
+     *
+     */
+    bool runs(uint const* program, size_t size) const {
+        word_array const& current = m.arrays[0];
+        return current.size() == size
+            && std::equal(current.begin(), current.end(), program);
+    }
+
+    uint load(uint array, uint offset) const { return m.load(array, offset); }
+    void store(uint array, uint offset, uint value) {
+        m.store(array, offset, value);
+    }
+    uint allocate(uint size) { return m.allocate(size); }
+    void deallocate(uint index) { m.deallocate(index); }
+    void output(uint value) { m.print_char(char(value)); }
+    uint input() { return m.read_char(); }
+
+    /**
+     * @brief Loads the given array into array 0
+     *
+     * @return true if that changed the program. Loading an array that array 0
+     * still shares its storage with changes nothing
+     */
+    bool load_program(uint index) {
+        if (m.arrays[0].shares_storage_with(m.arrays[index])) {
+            return false;
+        }
+        m.load_program(index);
+        return true;
+    }
+    /**
+     * @brief Executes the instruction at pc on the interpreter, updating pc
+     * and the registers
+     *
+     * @return false if translated code can't carry on afterwards: either the
+     * machine halted, or the instruction would replace array 0 or write into
+     * it, in which case it hasn't been executed yet
+     */
+    bool step(uint& pc, registers& r) {
+        if (pc >= m.arrays[0].size()) {
+            return false;
+        }
+        instruction i = m.get_instruction(pc);
+        if ((i.get_OP() == 2 && r[i.get_A()] == 0)
+            || (i.get_OP() == 12 && r[i.get_B()] != 0)) {
+            return false;
+        }
+        m.registers = r;
+        m.program_counter = pc;
+        m.run_loop_for(1);
+        r = m.registers;
+        pc = m.program_counter;
+        return !m.halted;
+    }
+    void halt(registers const& r) {
+        m.registers = r;
+        m.halted = true;
+        m.io.flush();
+    }
+    /**
+     * @brief Carries on from pc with the superinstruction engine (the
+     * default), until the machine halts. It's called directly rather than
+     * through run(), which would build every engine into translated programs
+     *
+     */
+    void resume(uint pc, registers const& r) {
+        m.registers = r;
+        m.program_counter = pc;
+        m.run_loop_superinstructions();
+    }
+};
+} // namespace compiler
@@ -0,0 +1,461 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <new>
+#include <utility>
+
+#if defined(__unix__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace compiler {
+/**
+ * @brief Allocator for the storage of arrays. Small blocks are grouped into
+ * size classes, with two classes per power of two, and carved out of large
+ * zeroed chunks. Freed blocks go onto a free list for their class, so churn
+ * doesn't go through malloc at all. Blocks larger than max_small_bytes go
+ * straight to calloc and free, except for blocks of min_mapped_bytes or more,
+ * which each get their own anonymous mapping where that's available. Their
+ * pages are zeroed by the kernel the first time they're touched, so a large
+ * array that's only partly used only costs the pages that are. Freed
+ * mappings give their pages back with MADV_DONTNEED, and a few are kept to
+ * be reused by blocks of the same size, which then start out zeroed again.
+ *
+ * Each thread has its own arena, so the fast path doesn't need any locking.
+ * Chunks are never returned to the system, but once the free blocks add up
+ * to trim_bytes (and again each time they double), the whole pages inside
+ * them are (see trim()). When a thread exits, its free lists and chunks are
+ * handed over to the next arena that gets created, which keeps blocks that
+ * outlive the thread valid.
+ *
+ * Once reserve_low_memory() has been called, chunks are taken from a region
+ * below 4GB for as long as it lasts, so that small blocks have 32-bit
+ * addresses. This is what lets machines use addresses as identifiers.
+ *
+ */
+class arena {
+   public:
+    static constexpr size_t min_block_bytes = 16;
+    static constexpr size_t max_small_bytes = size_t(64) << 10;
+    static constexpr size_t chunk_bytes = size_t(4) << 20;
+    static constexpr size_t trim_bytes = size_t(64) << 20;
+    static constexpr size_t min_mapped_bytes = size_t(1) << 20;
+    static constexpr size_t huge_page_bytes = size_t(2) << 20;
+    static constexpr size_t max_cached_mappings = 16;
+
+    // Classes 0 to 3 are 16, 32, 48, and 64 bytes. After that there are two
+    // classes per power of two: 96, 128, 192, 256, and so on
+    static constexpr size_t class_count = 4 + 2 * (15 - 6 + 1);
+
+    static constexpr size_t floor_log2(size_t value) {
+#if defined(__GNUC__)
+        return sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(value);
+#else
+        size_t result = 0;
+        while (value >>= 1) {
+            result++;
+        }
+        return result;
+#endif
+    }
+    static constexpr size_t size_class(size_t bytes) {
+        if (bytes <= 64) {
+            return bytes <= min_block_bytes ? 0 : (bytes - 1) / 16;
+        }
+        // 2^p < bytes <= 2^(p + 1)
+        size_t p = floor_log2(bytes - 1);
+        size_t sub = bytes > (size_t(3) << (p - 1)) ? 1 : 0;
+        return 4 + (p - 6) * 2 + sub;
+    }
+    static constexpr size_t class_bytes(size_t index) {
+        if (index < 4) {
+            return (index + 1) * 16;
+        }
+        size_t p = 6 + (index - 4) / 2;
+        return (index - 4) % 2 ? size_t(1) << (p + 1) : size_t(3) << (p - 1);
+    }
+
+    /**
+     * @brief The memory an arena has taken from the system, counting chunks
+     * and large blocks, and how much of it is in free blocks. Large blocks
+     * freed by another thread are counted against that thread
+     *
+     */
+    struct stats {
+        size_t reserved_bytes = 0;
+        size_t cached_bytes = 0;
+    };
+
+   private:
+    struct free_block {
+        free_block* next;
+    };
+    struct pool {
+        free_block* free_lists[class_count] {};
+        char* chunk = nullptr;
+        size_t chunk_remaining = 0;
+        stats counts;
+        // The cached bytes that set off the next trim
+        size_t trim_at = trim_bytes;
+        // Freed mappings that can be reused, by length
+        std::multimap<size_t, void*> mappings;
+    };
+
+    pool p;
+
+    // The region below 4GB that chunks are taken from, if one was reserved.
+    // low_next is the start of the part that hasn't been handed out yet
+    static inline std::atomic<uintptr_t> low_start {0};
+    static inline std::atomic<uintptr_t> low_next {0};
+    static inline std::atomic<uintptr_t> low_end {0};
+    static inline std::atomic<bool> huge_pages {false};
+
+    // Pools left behind by threads that have exited
+    static pool& orphans() {
+        static pool orphaned;
+        return orphaned;
+    }
+    static std::mutex& orphans_mutex() {
+        static std::mutex m;
+        return m;
+    }
+
+    // Puts what's left of a pool's current chunk onto its free lists, as the
+    // largest blocks that fit, so that the chunk can be replaced without
+    // losing the rest of it
+    static void retire_chunk(pool& target) {
+        while (target.chunk_remaining >= min_block_bytes) {
+            size_t index = std::min(
+                size_class(target.chunk_remaining),
+                class_count - 1);
+            if (class_bytes(index) > target.chunk_remaining) {
+                index--;
+            }
+            size_t bytes = class_bytes(index);
+            free_block* block = reinterpret_cast<free_block*>(target.chunk);
+            block->next = target.free_lists[index];
+            target.free_lists[index] = block;
+            target.counts.cached_bytes += bytes;
+            target.chunk += bytes;
+            target.chunk_remaining -= bytes;
+        }
+        target.chunk = nullptr;
+        target.chunk_remaining = 0;
+    }
+
+    // Adds the free lists of source onto the end of those in destination,
+    // and leaves source empty. Whichever pool has more room left in its
+    // chunk keeps it, and the rest of the other one goes onto the free lists
+    static void merge(pool& destination, pool& source) {
+        if (source.chunk_remaining > destination.chunk_remaining) {
+            std::swap(destination.chunk, source.chunk);
+            std::swap(destination.chunk_remaining, source.chunk_remaining);
+        }
+        retire_chunk(source);
+        for (size_t i = 0; i < class_count; i++) {
+            free_block** tail = &destination.free_lists[i];
+            while (*tail != nullptr) {
+                tail = &(*tail)->next;
+            }
+            *tail = source.free_lists[i];
+            source.free_lists[i] = nullptr;
+        }
+        destination.counts.reserved_bytes += source.counts.reserved_bytes;
+        destination.counts.cached_bytes += source.counts.cached_bytes;
+        source.counts = stats {};
+        destination.mappings.merge(source.mappings);
+    }
+
+    // Takes a chunk from the low region, or returns null if there isn't
+    // enough of it left. Fresh anonymous pages are already zeroed
+    static void* take_low_chunk() {
+        uintptr_t chunk = low_next.fetch_add(chunk_bytes);
+        if (chunk == 0 || chunk + chunk_bytes > low_end.load()) {
+            return nullptr;
+        }
+        return reinterpret_cast<void*>(chunk);
+    }
+
+    // Carves a block out of the current chunk. Chunks are always zeroed, so
+    // the block is too
+    void* carve(size_t bytes) {
+        if (p.chunk_remaining < bytes) {
+            retire_chunk(p);
+            void* chunk = take_low_chunk();
+            if (chunk == nullptr) {
+                chunk = std::calloc(1, chunk_bytes);
+            }
+            if (chunk == nullptr) {
+                throw std::bad_alloc();
+            }
+            p.chunk = static_cast<char*>(chunk);
+            p.chunk_remaining = chunk_bytes;
+            p.counts.reserved_bytes += chunk_bytes;
+        }
+        void* block = p.chunk;
+        p.chunk += bytes;
+        p.chunk_remaining -= bytes;
+        return block;
+    }
+
+#if defined(MAP_ANONYMOUS)
+    static constexpr bool maps_large_blocks = true;
+
+    // Blocks that could use huge pages are rounded up to them whether or not
+    // they're in use, so that the length doesn't depend on when it's asked
+    static size_t mapping_bytes(size_t bytes) {
+        static size_t const page = size_t(sysconf(_SC_PAGESIZE));
+        size_t unit = bytes >= huge_page_bytes ? huge_page_bytes : page;
+        return (bytes + unit - 1) & ~(unit - 1);
+    }
+    // Maps a block, reusing a freed mapping of the same length if there is
+    // one. Either way, the block reads as zeros
+    void* map(size_t bytes) {
+        size_t length = mapping_bytes(bytes);
+        p.counts.reserved_bytes += length;
+        auto cached = p.mappings.find(length);
+        if (cached != p.mappings.end()) {
+            void* block = cached->second;
+            p.mappings.erase(cached);
+            return block;
+        }
+        bool huge = huge_pages && length >= huge_page_bytes;
+        // Huge pages need the mapping to be aligned to them, so map enough
+        // to find an aligned block inside it, then unmap the rest
+        size_t padding = huge ? huge_page_bytes : 0;
+        void* region = mmap(
+            nullptr,
+            length + padding,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1,
+            0);
+        if (region == MAP_FAILED) {
+            p.counts.reserved_bytes -= length;
+            throw std::bad_alloc();
+        }
+        char* block = static_cast<char*>(region);
+        if (huge) {
+            uintptr_t start = reinterpret_cast<uintptr_t>(region);
+            uintptr_t aligned = (start + huge_page_bytes - 1)
+                              & ~(huge_page_bytes - 1);
+            block += aligned - start;
+            if (aligned != start) {
+                munmap(region, aligned - start);
+            }
+            if (size_t tail = padding - (aligned - start); tail != 0) {
+                munmap(block + length, tail);
+            }
+#if defined(MADV_HUGEPAGE)
+            madvise(block, length, MADV_HUGEPAGE);
+#endif
+        }
+        return block;
+    }
+    void unmap(void* block, size_t bytes) {
+        size_t length = mapping_bytes(bytes);
+        p.counts.reserved_bytes -= std::min(length, p.counts.reserved_bytes);
+        if (p.mappings.size() < max_cached_mappings) {
+            madvise(block, length, MADV_DONTNEED);
+            p.mappings.emplace(length, block);
+        } else {
+            munmap(block, length);
+        }
+    }
+    void unmap_cached() {
+        for (auto const& [length, block] : p.mappings) {
+            munmap(block, length);
+        }
+        p.mappings.clear();
+    }
+#else
+    static constexpr bool maps_large_blocks = false;
+
+    void* map(size_t) { return nullptr; }
+    void unmap(void*, size_t) {}
+    void unmap_cached() {}
+#endif
+
+   public:
+    arena() {
+        std::lock_guard<std::mutex> lock(orphans_mutex());
+        merge(p, orphans());
+    }
+    arena(arena const&) = delete;
+    arena& operator=(arena const&) = delete;
+    ~arena() {
+        std::lock_guard<std::mutex> lock(orphans_mutex());
+        merge(orphans(), p);
+    }
+
+    /**
+     * @brief Backs mapped blocks of 2MB or more with transparent huge pages
+     * from now on, where the system supports them, which means fewer TLB
+     * misses when scanning through a large array
+     *
+     */
+    static void use_huge_pages(bool enabled) { huge_pages = enabled; }
+
+    /**
+     * @brief Returns the arena belonging to the calling thread
+     *
+     */
+    static arena& local() {
+        static thread_local arena instance;
+        return instance;
+    }
+
+    /**
+     * @brief Reserves address space below 4GB for chunks to come from. The
+     * calling thread's arena stops carving from its current chunk, so that
+     * its next block comes from the new region. Other arenas switch over once
+     * their current chunk runs out.
+     *
+     * @return uintptr_t the start of the region, or 0 if there isn't one.
+     * Every block in the region is at or above this address
+     */
+    static uintptr_t reserve_low_memory() {
+        // Make sure this thread's arena exists before taking the lock, since
+        // creating it takes the lock too
+        arena& self = local();
+        std::lock_guard<std::mutex> lock(orphans_mutex());
+        if (low_start.load() == 0) {
+#if defined(MAP_32BIT) && defined(MAP_NORESERVE)
+            // MAP_32BIT only has the first 2GB to work with, so settle for
+            // less if a large region isn't available
+            for (size_t bytes = size_t(1) << 30; bytes >= chunk_bytes;
+                 bytes /= 2) {
+                void* region = mmap(
+                    nullptr,
+                    bytes,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT | MAP_NORESERVE,
+                    -1,
+                    0);
+                if (region != MAP_FAILED) {
+                    uintptr_t start = reinterpret_cast<uintptr_t>(region);
+                    low_end.store(start + bytes);
+                    low_next.store(start);
+                    low_start.store(start);
+                    break;
+                }
+            }
+#endif
+        }
+        if (low_start.load() != 0) {
+            retire_chunk(self.p);
+        }
+        return low_start.load();
+    }
+
+    /**
+     * @brief Allocates a block of at least the given number of bytes
+     *
+     * @param bytes the size of the block
+     * @param zeroed whether the block needs to be filled with zeros
+     */
+    void* allocate(size_t bytes, bool zeroed) {
+        if (maps_large_blocks && bytes >= min_mapped_bytes) {
+            return map(bytes);
+        }
+        if (bytes > max_small_bytes) {
+            void* block = zeroed ? std::calloc(1, bytes) : std::malloc(bytes);
+            if (block == nullptr) {
+                throw std::bad_alloc();
+            }
+            p.counts.reserved_bytes += bytes;
+            return block;
+        }
+        size_t index = size_class(bytes);
+        free_block* block = p.free_lists[index];
+        if (block == nullptr) {
+            return carve(class_bytes(index));
+        }
+        p.free_lists[index] = block->next;
+        p.counts.cached_bytes -= class_bytes(index);
+        if (zeroed) {
+            std::memset(block, 0, class_bytes(index));
+        }
+        return block;
+    }
+    /**
+     * @brief Returns a block to the arena. bytes has to be the size that the
+     * block was allocated with
+     *
+     */
+    void deallocate(void* block, size_t bytes) {
+        if (maps_large_blocks && bytes >= min_mapped_bytes) {
+            unmap(block, bytes);
+            return;
+        }
+        if (bytes > max_small_bytes) {
+            std::free(block);
+            p.counts.reserved_bytes -= std::min(bytes, p.counts.reserved_bytes);
+            return;
+        }
+        size_t index = size_class(bytes);
+        free_block* freed = static_cast<free_block*>(block);
+        freed->next = p.free_lists[index];
+        p.free_lists[index] = freed;
+        p.counts.cached_bytes += class_bytes(index);
+        if (p.counts.cached_bytes >= p.trim_at) {
+            trim();
+        }
+    }
+
+    /**
+     * @brief Gives the whole pages inside free blocks back to the system.
+     * The blocks stay on their free lists, and their pages come back zeroed
+     * the next time they're touched. Freed mappings kept for reuse are
+     * unmapped, and malloc is asked to give back what large blocks left
+     * behind
+     *
+     */
+    void trim() {
+#if defined(__unix__) && defined(MADV_DONTNEED)
+        uintptr_t page = uintptr_t(sysconf(_SC_PAGESIZE));
+        for (size_t i = size_class(2 * page); i < class_count; i++) {
+            for (free_block* block = p.free_lists[i]; block != nullptr;
+                 block = block->next) {
+                // The start of the block holds the link to the next one
+                uintptr_t start = reinterpret_cast<uintptr_t>(block + 1);
+                uintptr_t end = reinterpret_cast<uintptr_t>(block)
+                              + class_bytes(i);
+                start = (start + page - 1) & ~(page - 1);
+                end &= ~(page - 1);
+                if (start < end) {
+                    madvise(
+                        reinterpret_cast<void*>(start),
+                        end - start,
+                        MADV_DONTNEED);
+                }
+            }
+        }
+#endif
+        unmap_cached();
+#if defined(__GLIBC__)
+        malloc_trim(0);
+#endif
+        p.trim_at = std::max(trim_bytes, 2 * p.counts.cached_bytes);
+    }
+    stats get_stats() const { return p.counts; }
+};
+
+static_assert(
+    arena::size_class(arena::max_small_bytes) + 1 == arena::class_count,
+    "the largest small block should be in the last size class");
+static_assert(
+    arena::class_bytes(arena::size_class(97)) == 128,
+    "blocks should be rounded up to the next size class");
+} // namespace compiler
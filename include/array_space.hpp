@@ -0,0 +1,396 @@
+#pragma once
+
+#include <algorithm>
+#include <arena.hpp>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <word_array.hpp>
+
+namespace compiler {
+/**
+ * @brief Thrown by an allocation that would take a machine over its memory
+ * limit
+ *
+ */
+class memory_limit_exceeded : public std::runtime_error {
+   public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * @brief How much memory a machine's arrays take up. Arrays that share their
+ * storage are counted in full, once for each array
+ *
+ */
+struct memory_usage {
+    // The words in every allocated array
+    size_t words = 0;
+    size_t arrays = 0;
+    // Entries in the table of arrays, including free ones
+    size_t table_entries = 0;
+    // What the arena of the calling thread, which machines on that thread
+    // share, has taken from the system, and how much of that is free blocks
+    // waiting to be reused (see arena)
+    size_t reserved_bytes = 0;
+    size_t cached_bytes = 0;
+};
+
+/**
+ * @brief The arrays of a machine, indexed by their identifiers. Each entry is
+ * a single pointer to the storage of an array, with the length kept in a
+ * header in front of the words (see word_array), so eight entries fit in a
+ * cache line.
+ *
+ * Freed identifiers are linked together through their own entries, so there's
+ * no separate free list. A free entry holds the next free identifier, shifted
+ * left by one with the low bit set; storage pointers never have that bit set.
+ *
+ * With pointer identifiers enabled, an array whose words lie below 4GB is
+ * identified by the address of its words instead, so looking it up doesn't
+ * touch the table at all. Every identifier at or above pointer_base is an
+ * address. The array still has an entry in the table, which owns it, and the
+ * padding word after the array holds the index of that entry. Arrays that
+ * don't fit below 4GB (large ones, or any once the region there runs out)
+ * get ordinary identifiers.
+ *
+ */
+class array_space {
+    std::vector<word_array> entries;
+    // The most recently freed identifier, or 0 if there aren't any. Array 0
+    // is never freed, so 0 can't be on the list
+    uint free_head = 0;
+    // The lowest identifier that's an address. Table indices are always
+    // below it
+    uint pointer_base = ~uint(0);
+    // Words in allocated arrays, and the most the arrays can take up (see
+    // charged_words())
+    size_t live_words = 0;
+    size_t word_limit = ~size_t(0);
+    size_t free_count = 0;
+    // The number of free entries that makes the table get trimmed next
+    size_t trim_at = min_trim_entries;
+
+    friend class snapshot;
+
+    static uint* address_of(uint id) {
+        return reinterpret_cast<uint*>(uintptr_t(id));
+    }
+    // The index of the table entry that owns the array with the given
+    // pointer identifier
+    static uint entry_of(uint id) {
+        uint const* words = address_of(id);
+        return words[word_array::header_of(words).size];
+    }
+
+    static bool is_free(word_array const& entry) {
+        return reinterpret_cast<uintptr_t>(entry.words) & 1;
+    }
+    static uint next_free(word_array const& entry) {
+        return uint(reinterpret_cast<uintptr_t>(entry.words) >> 1);
+    }
+    static void link_free(word_array& entry, uint next) {
+        entry.words = reinterpret_cast<uint*>(uintptr_t(next) << 1 | 1);
+    }
+    static void make_free(word_array& entry, uint next) {
+        entry.release();
+        link_free(entry, next);
+    }
+    // Free entries don't own any storage, so they have to be emptied before
+    // they're destroyed
+    void forget_free_entries() {
+        for (uint id = free_head; id != 0;) {
+            uint next = next_free(entries[id]);
+            entries[id].words = nullptr;
+            id = next;
+        }
+        free_head = 0;
+    }
+
+    // Counts the arrays and their words from scratch
+    void recount() {
+        live_words = 0;
+        free_count = 0;
+        for (word_array const& entry : entries) {
+            if (is_free(entry)) {
+                free_count++;
+            } else {
+                live_words += entry.size();
+            }
+        }
+        trim_at = std::max(min_trim_entries, 2 * free_count);
+    }
+
+    // What the arrays take up in words for the limit: their own words, the
+    // header and padding word of each, and every entry of the table
+    size_t charged_words() const {
+        size_t arrays = entries.size() - free_count;
+        return live_words
+             + (arrays * word_array::block_bytes(0)
+                + entries.size() * sizeof(word_array))
+                   / sizeof(uint);
+    }
+
+   public:
+    // The table isn't trimmed until it has at least this many free entries
+    static constexpr size_t min_trim_entries = size_t(1) << 16;
+
+    array_space() = default;
+    array_space(array_space const& other)
+      : free_head(other.free_head)
+      , live_words(other.live_words)
+      , word_limit(other.word_limit)
+      , free_count(other.free_count)
+      , trim_at(other.trim_at) {
+        // A copy can't have the same addresses as the original
+        if (other.uses_pointer_ids()) {
+            throw std::logic_error(
+                "Arrays identified by their addresses can't be copied");
+        }
+        entries.reserve(other.entries.size());
+        for (word_array const& entry : other.entries) {
+            if (is_free(entry)) {
+                entries.emplace_back().words = entry.words;
+            } else {
+                entries.push_back(entry);
+            }
+        }
+    }
+    array_space(array_space&& other) noexcept
+      : entries(std::move(other.entries))
+      , free_head(std::exchange(other.free_head, 0))
+      , pointer_base(std::exchange(other.pointer_base, ~uint(0)))
+      , live_words(std::exchange(other.live_words, 0))
+      , word_limit(other.word_limit)
+      , free_count(std::exchange(other.free_count, 0))
+      , trim_at(other.trim_at) {}
+    array_space& operator=(array_space other) noexcept {
+        std::swap(entries, other.entries);
+        std::swap(free_head, other.free_head);
+        std::swap(pointer_base, other.pointer_base);
+        std::swap(live_words, other.live_words);
+        std::swap(word_limit, other.word_limit);
+        std::swap(free_count, other.free_count);
+        std::swap(trim_at, other.trim_at);
+        return *this;
+    }
+    ~array_space() { forget_free_entries(); }
+
+    /**
+     * @brief Returns the array with the given identifier, which may be an
+     * address
+     *
+     */
+    word_array& operator[](uint id) {
+        return entries[id >= pointer_base ? entry_of(id) : id];
+    }
+    word_array const& operator[](uint id) const {
+        return entries[id >= pointer_base ? entry_of(id) : id];
+    }
+    /**
+     * @brief Returns the words of the array with the given identifier. For
+     * pointer identifiers, this doesn't read any memory
+     *
+     */
+    uint const* words(uint id) const {
+        return id >= pointer_base ? address_of(id) : entries[id].data();
+    }
+    /**
+     * @brief Writes a word to an array, copying its storage first if it's
+     * shared
+     *
+     */
+    void store(uint id, uint offset, uint value) {
+        if (id < pointer_base) {
+            entries[id].set(offset, value);
+            return;
+        }
+        // The words of an array with a pointer identifier can't move, so
+        // whichever array it shares them with gets the copy instead. Only
+        // array 0 can share storage with another array, since arrays with
+        // pointer identifiers are never copied
+        uint* words = address_of(id);
+        if (word_array::is_shared(words)) {
+            entries[0].detach();
+        }
+        words[offset] = value;
+    }
+
+    /**
+     * @brief Starts identifying new arrays by their addresses, whenever
+     * they're below 4GB. Arrays that already exist keep their identifiers
+     *
+     * @return true if pointer identifiers are now in use, or false if there
+     * isn't any memory below 4GB to be had on this platform
+     */
+    bool enable_pointer_ids() {
+        uintptr_t base = arena::reserve_low_memory();
+        // Identifiers at or above the base have to be distinguishable from
+        // table indices
+        if (base == 0 || base <= entries.size()) {
+            return false;
+        }
+        pointer_base = uint(base);
+        return true;
+    }
+    bool uses_pointer_ids() const { return pointer_base != ~uint(0); }
+    /**
+     * @brief The lowest identifier that's an address rather than an index
+     * into the table. This is ~0 if pointer identifiers aren't in use
+     *
+     */
+    uint get_pointer_base() const { return pointer_base; }
+    word_array* data() { return entries.data(); }
+    word_array const* data() const { return entries.data(); }
+    /**
+     * @brief The number of entries, including the ones that are free
+     *
+     */
+    size_t size() const { return entries.size(); }
+
+    /**
+     * @brief Adds an array with a brand new identifier, without reusing any
+     * freed ones
+     *
+     */
+    uint push_back(word_array array) {
+        if (entries.size() >= pointer_base) {
+            throw std::length_error("Too many arrays to tell apart from "
+                                    "addresses");
+        }
+        live_words += array.size();
+        entries.push_back(std::move(array));
+        return uint(entries.size() - 1);
+    }
+    /**
+     * @brief Creates a zero-filled array, reusing the most recently freed
+     * identifier if there is one
+     *
+     * @param size the number of words in the array
+     * @return uint the identifier of the new array
+     * @throws memory_limit_exceeded if the array would take the arrays over
+     * the limit
+     */
+    uint allocate(uint size) {
+        size_t cost = word_array::block_bytes(size)
+                    + (free_head == 0 ? sizeof(word_array) : 0);
+        if (charged_words() + cost / sizeof(uint) > word_limit) {
+            throw memory_limit_exceeded(
+                "Allocating " + std::to_string(size)
+                + " words would go over the limit of "
+                + std::to_string(word_limit) + " words");
+        }
+        uint id;
+        if (free_head == 0) {
+            id = push_back(word_array(size));
+        } else {
+            id = free_head;
+            free_head = next_free(entries[id]);
+            entries[id].words = nullptr;
+            entries[id] = word_array(size);
+            live_words += size;
+            free_count--;
+        }
+        if (uses_pointer_ids()) {
+            uint* words = entries[id].words;
+            uintptr_t address = reinterpret_cast<uintptr_t>(words);
+            if (address >= pointer_base && address <= ~uint(0)) {
+                words[size] = id;
+                return uint(address);
+            }
+        }
+        return id;
+    }
+    /**
+     * @brief Frees an array, so that its identifier can be reused
+     *
+     */
+    void deallocate(uint id) {
+        if (id >= pointer_base) {
+            id = entry_of(id);
+        }
+        live_words -= entries[id].size();
+        make_free(entries[id], free_head);
+        free_head = id;
+        free_count++;
+        // The threshold doubles each time, so that programs that keep
+        // freeing the last entry don't walk the free list every time
+        if (free_count >= trim_at) {
+            trim();
+            trim_at = std::max(min_trim_entries, 2 * free_count);
+        }
+    }
+    /**
+     * @brief Replaces an array that's allocated, such as array 0 when a
+     * program is loaded
+     *
+     */
+    void replace(uint id, word_array array) {
+        word_array& entry = (*this)[id];
+        live_words = live_words - entry.size() + array.size();
+        entry = std::move(array);
+    }
+
+    /**
+     * @brief Drops the free entries at the end of the table, and gives back
+     * the memory they took up. This takes a walk over the free list, so
+     * deallocate() only does it once the number of free entries has doubled
+     * since the last time
+     *
+     */
+    void trim() {
+        size_t size = entries.size();
+        while (size > 1 && is_free(entries[size - 1])) {
+            size--;
+        }
+        if (size == entries.size()) {
+            return;
+        }
+        // Unlink the entries that are going, keeping the others in order
+        uint head = 0, tail = 0;
+        for (uint id = free_head; id != 0;) {
+            uint next = next_free(entries[id]);
+            if (id < size) {
+                if (tail == 0) {
+                    head = id;
+                } else {
+                    link_free(entries[tail], id);
+                }
+                tail = id;
+            }
+            id = next;
+        }
+        if (tail != 0) {
+            link_free(entries[tail], 0);
+        }
+        free_head = head;
+        free_count -= entries.size() - size;
+        for (size_t id = size; id < entries.size(); id++) {
+            entries[id].words = nullptr;
+        }
+        entries.resize(size);
+        entries.shrink_to_fit();
+    }
+
+    /**
+     * @brief Limits the words that all allocated arrays take up together,
+     * counting the header and padding word of each array and the entries of
+     * the table, so that even empty arrays count. Allocations that would go
+     * over it throw memory_limit_exceeded. Arrays that are already allocated
+     * are kept even if they're over it
+     *
+     */
+    void set_word_limit(size_t limit) { word_limit = limit; }
+    size_t get_word_limit() const { return word_limit; }
+    bool has_word_limit() const { return word_limit != ~size_t(0); }
+    memory_usage usage() const {
+        memory_usage result;
+        result.words = live_words;
+        result.arrays = entries.size() - free_count;
+        result.table_entries = entries.size();
+        return result;
+    }
+};
+} // namespace compiler
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <ins.hpp>
+#include <stdexcept>
+#include <vector>
+#include <word_array.hpp>
+
+namespace compiler {
+/**
+ * @brief Builds UM programs an instruction at a time, for tools and
+ * benchmarks that generate their own programs.
+ *
+ * Jumps go through op 12 with array 0, so they need a register holding 0:
+ * jump() and branch_if_nonzero() assume that register 0 always holds 0.
+ * Labels can be used before they're bound, and are filled in by finish().
+ *
+ */
+class assembler {
+   public:
+    using label = size_t;
+    // The largest value op 13 can load
+    static constexpr uint max_value = (uint(1) << 25) - 1;
+
+   private:
+    struct fixup {
+        size_t position;
+        uint reg;
+        label target;
+    };
+    static constexpr uint unbound = ~uint(0);
+
+    std::vector<uint> words;
+    std::vector<uint> labels;
+    std::vector<fixup> fixups;
+
+   public:
+    static constexpr uint encode(uint op, uint a = 0, uint b = 0, uint c = 0) {
+        return op << 28 | a << 6 | b << 3 | c;
+    }
+    static constexpr uint encode_load_value(uint reg, uint value) {
+        return uint(13) << 28 | reg << 25 | (value & max_value);
+    }
+
+    /**
+     * @brief The position the next instruction will be placed at
+     *
+     */
+    uint position() const { return uint(words.size()); }
+    void emit(uint word) { words.push_back(word); }
+
+    void cmov(uint a, uint b, uint c) { emit(encode(0, a, b, c)); }
+    void load(uint a, uint b, uint c) { emit(encode(1, a, b, c)); }
+    void store(uint a, uint b, uint c) { emit(encode(2, a, b, c)); }
+    void add(uint a, uint b, uint c) { emit(encode(3, a, b, c)); }
+    void mul(uint a, uint b, uint c) { emit(encode(4, a, b, c)); }
+    void div(uint a, uint b, uint c) { emit(encode(5, a, b, c)); }
+    void nand(uint a, uint b, uint c) { emit(encode(6, a, b, c)); }
+    void halt() { emit(encode(7)); }
+    void alloc(uint b, uint c) { emit(encode(8, 0, b, c)); }
+    void free(uint c) { emit(encode(9, 0, 0, c)); }
+    void output(uint c) { emit(encode(10, 0, 0, c)); }
+    void input(uint c) { emit(encode(11, 0, 0, c)); }
+    void load_program(uint b, uint c) { emit(encode(12, 0, b, c)); }
+    void load_value(uint reg, uint value) {
+        if (value > max_value) {
+            throw std::out_of_range("Value doesn't fit in op 13");
+        }
+        emit(encode_load_value(reg, value));
+    }
+
+    // a = b & c
+    void bitwise_and(uint a, uint b, uint c) {
+        nand(a, b, c);
+        nand(a, a, a);
+    }
+    /**
+     * @brief Loads any 32-bit value, using scratch if it doesn't fit in a
+     * single op 13
+     *
+     */
+    void load_constant(uint reg, uint value, uint scratch) {
+        if (value <= max_value) {
+            load_value(reg, value);
+            return;
+        }
+        load_value(reg, value >> 16);
+        load_value(scratch, 1 << 16);
+        mul(reg, reg, scratch);
+        load_value(scratch, value & 0xffff);
+        add(reg, reg, scratch);
+    }
+
+    label new_label() {
+        labels.push_back(unbound);
+        return labels.size() - 1;
+    }
+    void bind(label l) { labels[l] = position(); }
+    label here() {
+        label l = new_label();
+        bind(l);
+        return l;
+    }
+    // Loads the position of a label into a register
+    void load_label(uint reg, label l) {
+        fixups.push_back(fixup {words.size(), reg, l});
+        emit(encode_load_value(reg, 0));
+    }
+    void jump(label target, uint scratch) {
+        load_label(scratch, target);
+        load_program(0, scratch);
+    }
+    /**
+     * @brief Jumps to target if cond isn't 0, and otherwise carries on with
+     * the next instruction. Both scratch registers are overwritten
+     *
+     */
+    void branch_if_nonzero(uint cond, label target, uint scratch, uint other) {
+        load_value(scratch, position() + 4);
+        load_label(other, target);
+        cmov(scratch, other, cond);
+        load_program(0, scratch);
+    }
+    // Adds 0 words until the program is the given size
+    void pad_to(size_t size) {
+        if (words.size() < size) {
+            words.resize(size);
+        }
+    }
+
+    /**
+     * @brief Fills in the labels, and returns the program
+     *
+     */
+    std::vector<uint> const& finish() {
+        for (fixup const& f : fixups) {
+            uint target = labels[f.target];
+            if (target == unbound || target > max_value) {
+                throw std::logic_error("Label isn't bound, or is too far");
+            }
+            words[f.position] = encode_load_value(f.reg, target);
+        }
+        return words;
+    }
+    word_array build() {
+        std::vector<uint> const& program = finish();
+        return word_array(program.data(), program.size());
+    }
+    /**
+     * @brief Writes the program to a file, as big-endian words
+     *
+     */
+    void write(std::filesystem::path const& filename) {
+        std::vector<uint> const& program = finish();
+        std::vector<char> bytes(program.size() * 4);
+        for (size_t i = 0; i < program.size(); i++) {
+            bytes[i * 4] = char(program[i] >> 24);
+            bytes[i * 4 + 1] = char(program[i] >> 16);
+            bytes[i * 4 + 2] = char(program[i] >> 8);
+            bytes[i * 4 + 3] = char(program[i]);
+        }
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        file.write(bytes.data(), std::streamsize(bytes.size()));
+        if (!file) {
+            throw std::runtime_error(
+                "Couldn't write '" + filename.string() + "'");
+        }
+    }
+};
+} // namespace compiler
@@ -16,7 +16,7 @@
     {                                                                          \
         uint offset = get_C_register(INS);                                     \
         uint array_index = get_B_register(INS);                                \
-        set_A_register(INS, arrays[array_index][offset]);                      \
+        set_A_register(INS, load(array_index, offset));                        \
     }
 
 
@@ -26,7 +26,7 @@
     {                                                                          \
         uint array_index = get_A_register(INS);                                \
         uint offset = get_B_register(INS);                                     \
-        arrays[array_index][offset] = get_C_register(INS);                     \
+        store(array_index, offset, get_C_register(INS));                       \
     }
 
 
@@ -57,9 +57,14 @@
     { set_A_register(INS, ~(get_B_register(INS) & get_C_register(INS))); }
 
 
-// Opcode 7: The machine stops computation
+// Opcode 7: The machine stops computation. Any buffered output is flushed
+// first
 #define OPCODE_7(INS)                                                          \
-    { return; }
+    {                                                                          \
+        halted = true;                                                         \
+        io.flush();                                                            \
+        return;                                                                \
+    }
 
 // Opcode 8: A new array is created; the value in the
 // register C gives the number of words in the new array.
@@ -68,7 +73,10 @@
 // no other active allocated array, is placed in the B
 // register, and it identifies the new array.
 #define OPCODE_8(INS)                                                          \
-    { set_B_register(INS, allocate(get_C_register(INS))); }
+    {                                                                          \
+        COMPILER_ON_ALLOCATE(get_C_register(INS));                             \
+        set_B_register(INS, allocate(get_C_register(INS)));                    \
+    }
 
 
 // Opcode 9: The array identified by the register C is
@@ -91,14 +99,7 @@
 // end of input has been signaled, then the register C is
 // filled with all 1’s.
 #define OPCODE_11(INS)                                                         \
-    {                                                                          \
-        int ch = getchar();                                                    \
-        if (ch == EOF) {                                                       \
-            set_C_register(INS, ~0u);                                          \
-        } else {                                                               \
-            set_C_register(INS, uint(ch) & 0xffu);                             \
-        }                                                                      \
-    }
+    { set_C_register(INS, read_char()); }
 
 
 // Opcode 12: The array identified by the B register is
@@ -108,18 +109,28 @@
 // offset given in C, where the value 0 denotes the first
 // word, 1 the second, etc.
 
-// NB: We add one padding op at the end in order to allow operations to be
-// grouped together. This enables batching of instructions
+// NB: Every word_array has one padding word past its end, so array 0 does too.
+// This allows operations to be grouped together, which enables batching of
+// instructions
 
-#define OPCODE_12(INS)                                                         \
+// LOAD_PROGRAM does everything except continue the loop, so it can also be
+// used by engines that don't dispatch from a loop. The target is read before
+// loading, since INS may refer to the program being replaced
+#define LOAD_PROGRAM(INS)                                                      \
     {                                                                          \
         uint array_index = get_B_register(INS);                                \
+        uint target = get_C_register(INS);                                     \
         if (array_index != 0) {                                                \
-            arrays[0] = arrays[array_index];                                   \
-            arrays[0].push_back(0);                                            \
-            instruction_ptr = arrays[0].data();                                \
+            load_program(array_index);                                         \
+            instruction_ptr = program_start(instruction_ptr);                  \
         }                                                                      \
-        counter = get_C_register(INS);                                         \
+        COMPILER_ON_LOAD_PROGRAM(array_index, arrays[0]);                      \
+        counter = target;                                                      \
+    }
+
+#define OPCODE_12(INS)                                                         \
+    {                                                                          \
+        LOAD_PROGRAM(INS);                                                     \
         continue;                                                              \
     }
 
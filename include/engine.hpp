@@ -0,0 +1,121 @@
+#pragma once
+
+#include <ir.hpp>
+#include <jit.hpp>
+#include <machine.hpp>
+#include <optional>
+#include <string_view>
+
+namespace compiler {
+/**
+ * @brief The different ways a machine can be executed. Every engine produces
+ * the same results; they only differ in how instructions get dispatched.
+ *
+ */
+enum class engine {
+    switch_loop,
+    superinstructions,
+    threaded,
+    tail_call,
+    specialized,
+    jit,
+    ir,
+    trace,
+};
+
+struct engine_info {
+    engine kind;
+    std::string_view name;
+    std::string_view description;
+    // False if the engine isn't supported by this compiler or platform, or
+    // was left out of the build
+    bool available;
+};
+
+constexpr engine_info engines[] {
+    {engine::switch_loop,
+     "switch",
+     "switch on each opcode",
+     true},
+    {engine::superinstructions,
+     "super",
+     "switch on profiled sequences of opcodes",
+     true},
+    {engine::threaded,
+     "threaded",
+     "direct threading with computed goto",
+     COMPILER_HAS_COMPUTED_GOTO},
+    {engine::tail_call,
+     "tailcall",
+     "one handler function per opcode, chained by tail calls",
+     COMPILER_HAS_TAIL_CALLS},
+    {engine::specialized,
+     "specialized",
+     "one handler per opcode and registers, chained by tail calls",
+     COMPILER_HAS_SPECIALIZED},
+    {engine::jit, "jit", "basic blocks compiled to x86-64", COMPILER_HAS_JIT},
+    {engine::ir,
+     "ir",
+     "basic blocks optimized in an intermediate form, then interpreted",
+     true},
+    {engine::trace,
+     "trace",
+     "the ir engine, with hot loops recorded into traces across jumps",
+     true},
+};
+
+constexpr engine default_engine = engine::superinstructions;
+
+constexpr engine_info const& get_engine_info(engine kind) {
+    for (engine_info const& info : engines) {
+        if (info.kind == kind) {
+            return info;
+        }
+    }
+    return engines[0];
+}
+
+constexpr std::optional<engine> find_engine(std::string_view name) {
+    for (engine_info const& info : engines) {
+        if (info.name == name) {
+            return info.kind;
+        }
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief Runs the machine until it halts with the given engine. Engines that
+ * aren't available in this build fall back to the default engine.
+ *
+ */
+inline void run(machine& m, engine kind) {
+    if (!get_engine_info(kind).available) {
+        kind = default_engine;
+    }
+    switch (kind) {
+        case engine::switch_loop: m.run_loop(); break;
+        case engine::superinstructions:
+            m.run_loop_superinstructions();
+            break;
+        case engine::threaded:
+#if COMPILER_HAS_COMPUTED_GOTO
+            m.run_loop_threaded();
+#endif
+            break;
+        case engine::tail_call:
+#if COMPILER_HAS_TAIL_CALLS
+            m.run_loop_tail_call();
+#endif
+            break;
+        case engine::specialized:
+#if COMPILER_HAS_SPECIALIZED
+            m.run_loop_specialized();
+#endif
+            break;
+        case engine::jit: run_jit(m); break;
+        case engine::ir: run_ir(m); break;
+        case engine::trace: run_trace(m); break;
+    }
+}
+} // namespace compiler
@@ -1,9 +1,32 @@
 #pragma once
 
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <machine.hpp>
 #include <string_view>
+#include <system_error>
+#include <word_array.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define COMPILER_HAS_MMAP_LOADER 1
+#else
+#define COMPILER_HAS_MMAP_LOADER 0
+#endif
+
+// The byte-swapping kernels are compiled for SSSE3 and AVX2 regardless of the
+// flags the rest of the program is built with, and picked at runtime
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define COMPILER_HAS_SIMD_BYTESWAP 1
+#else
+#define COMPILER_HAS_SIMD_BYTESWAP 0
+#endif
 
 namespace compiler {
 namespace fs = std::filesystem;
@@ -24,7 +47,7 @@ auto read_all_bytes(fs::path filename) {
     return bytes;
 }
 
-uint32_t read_one_word(std::byte* bytes) {
+uint32_t read_one_word(std::byte const* bytes) {
     // When the program file is read, each consecutively read four bytes A, B,
     // C, D should be interpreted with A as the most significant byte, etc. (The
     // program file size as reported by Unix ls will always be divisible by 4.)
@@ -34,17 +57,132 @@ uint32_t read_one_word(std::byte* bytes) {
                   | uint32_t(bytes[3]);      // Byte D
     return word;
 }
-std::vector<uint> read_words_from_bytes(std::vector<std::byte> bytes) {
-    auto words = std::vector<uint32_t>(bytes.size() / 4);
-    for (size_t i = 0; i < words.size(); i++) {
-        size_t byte_offset = i * 4;
-        words[i] = read_one_word(bytes.data() + byte_offset);
+
+#if COMPILER_HAS_SIMD_BYTESWAP
+__attribute__((target("avx2"))) inline size_t read_big_endian_words_avx2(
+    std::byte const* bytes,
+    uint* words,
+    size_t count) {
+    __m256i const reverse = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256(
+            reinterpret_cast<__m256i const*>(bytes + i * 4));
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i*>(words + i),
+            _mm256_shuffle_epi8(v, reverse));
+    }
+    return i;
+}
+__attribute__((target("ssse3"))) inline size_t read_big_endian_words_ssse3(
+    std::byte const* bytes,
+    uint* words,
+    size_t count) {
+    __m128i const reverse = _mm_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128(
+            reinterpret_cast<__m128i const*>(bytes + i * 4));
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(words + i),
+            _mm_shuffle_epi8(v, reverse));
+    }
+    return i;
+}
+#endif
+
+/**
+ * @brief Converts count big-endian words into native words. bytes and words
+ * may be the same memory, but otherwise can't overlap
+ *
+ */
+inline void read_big_endian_words(
+    std::byte const* bytes,
+    uint* words,
+    size_t count) {
+    size_t i = 0;
+#if COMPILER_HAS_SIMD_BYTESWAP
+    if (__builtin_cpu_supports("avx2")) {
+        i = read_big_endian_words_avx2(bytes, words, count);
+    } else if (__builtin_cpu_supports("ssse3")) {
+        i = read_big_endian_words_ssse3(bytes, words, count);
+    }
+#endif
+    for (; i < count; i++) {
+        words[i] = read_one_word(bytes + i * 4);
     }
+}
+
+std::vector<uint> read_words_from_bytes(std::vector<std::byte> const& bytes) {
+    auto words = std::vector<uint32_t>(bytes.size() / 4);
+    read_big_endian_words(bytes.data(), words.data(), words.size());
     return words;
 }
 
+/**
+ * @brief Reads a program straight into a word_array, which can become array
+ * 0 without being copied. The file is mapped into memory where possible, so
+ * the only pass over the data is the one converting it to native words.
+ *
+ * @param filename the program to read
+ * @return word_array the words of the program. Any bytes past the last whole
+ * word are ignored
+ */
+inline word_array read_program(fs::path const& filename) {
+    auto fail = [&](char const* what) {
+        throw std::system_error(
+            errno,
+            std::generic_category(),
+            std::string(what) + " '" + filename.string() + "'");
+    };
+#if COMPILER_HAS_MMAP_LOADER
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fail("Couldn't open");
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        fail("Couldn't read the size of");
+    }
+    size_t size = size_t(info.st_size);
+    word_array program = word_array::uninitialized(size / 4);
+    if (size >= 4) {
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            fail("Couldn't map");
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        read_big_endian_words(
+            static_cast<std::byte const*>(mapped),
+            program.mutable_data(),
+            program.size());
+        munmap(mapped, size);
+    }
+    close(fd);
+    return program;
+#else
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        fail("Couldn't open");
+    }
+    word_array program = word_array::uninitialized(fs::file_size(filename) / 4);
+    // Read the file into the array, and convert it in place
+    uint* words = program.mutable_data();
+    file.read(reinterpret_cast<char*>(words), program.size() * 4);
+    read_big_endian_words(
+        reinterpret_cast<std::byte const*>(words),
+        words,
+        program.size());
+    return program;
+#endif
+}
+
 machine load_from_file(fs::path filename) {
-    auto words = read_words_from_bytes(read_all_bytes(filename));
-    return machine(words);
+    return machine(read_program(filename));
 }
 } // namespace compiler
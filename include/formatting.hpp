@@ -3,6 +3,29 @@
 #include <fmt/format.h>
 #include <fmt/ranges.h>
 #include <ins.hpp>
+#include <string>
+#include <string_view>
+
+namespace compiler {
+/**
+ * @brief Quotes text as a JSON string, escaping what needs to be escaped
+ *
+ */
+inline std::string json_string(std::string_view text) {
+    std::string result = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if ((unsigned char)c < ' ') {
+            result += fmt::format("\\u{:04x}", (unsigned char)c);
+        } else {
+            result += c;
+        }
+    }
+    return result + "\"";
+}
+} // namespace compiler
 
 template <>
 struct fmt::formatter<compiler::instruction> : fmt::formatter<uint32_t> {
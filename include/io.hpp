@@ -0,0 +1,536 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <unistd.h>
+#define COMPILER_HAS_FD_IO 1
+#else
+#define COMPILER_HAS_FD_IO 0
+#endif
+
+namespace compiler {
+/**
+ * @brief Somewhere for the output of a machine to go. Writes may be buffered
+ * by the sink; flush() makes sure everything written so far has been
+ * delivered
+ *
+ */
+class output_sink {
+   public:
+    virtual ~output_sink() = default;
+    virtual void write(char const* data, size_t size) = 0;
+    virtual void flush() {}
+};
+
+/**
+ * @brief Somewhere for the input of a machine to come from
+ *
+ */
+class input_source {
+   public:
+    virtual ~input_source() = default;
+    /**
+     * @brief Reads up to size bytes, waiting until at least one is available
+     *
+     * @return size_t the number of bytes read, or 0 at the end of the input
+     */
+    virtual size_t read(char* data, size_t size) = 0;
+    /**
+     * @brief False if read() would have to wait for input. Sources that
+     * can't tell say true, and wait in read()
+     *
+     */
+    virtual bool ready() const { return true; }
+};
+
+#if COMPILER_HAS_FD_IO
+/**
+ * @brief Writes straight to a file descriptor, with no buffering of its own
+ *
+ */
+class fd_sink : public output_sink {
+    int fd;
+
+   public:
+    explicit fd_sink(int fd)
+      : fd(fd) {}
+    void write(char const* data, size_t size) override {
+        while (size > 0) {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                // Nowhere left to report the error, so drop the output
+                return;
+            }
+            data += written;
+            size -= size_t(written);
+        }
+    }
+};
+
+class fd_source : public input_source {
+    int fd;
+
+   public:
+    explicit fd_source(int fd)
+      : fd(fd) {}
+    size_t read(char* data, size_t size) override {
+        for (;;) {
+            ssize_t count = ::read(fd, data, size);
+            if (count >= 0) {
+                return size_t(count);
+            }
+            if (errno != EINTR) {
+                return 0;
+            }
+        }
+    }
+};
+#endif
+
+/**
+ * @brief Writes through a stdio stream, a byte at a time if need be. This is
+ * how output worked before sinks existed
+ *
+ */
+class stdio_sink : public output_sink {
+    std::FILE* file;
+
+   public:
+    explicit stdio_sink(std::FILE* file)
+      : file(file) {}
+    void write(char const* data, size_t size) override {
+        std::fwrite(data, 1, size, file);
+    }
+    void flush() override { std::fflush(file); }
+};
+
+/**
+ * @brief Reads through a stdio stream one byte at a time, so that nothing
+ * past what the machine asks for is taken out of the stream
+ *
+ */
+class stdio_source : public input_source {
+    std::FILE* file;
+
+   public:
+    explicit stdio_source(std::FILE* file)
+      : file(file) {}
+    size_t read(char* data, size_t size) override {
+        int ch = size == 0 ? EOF : std::getc(file);
+        if (ch == EOF) {
+            return 0;
+        }
+        data[0] = char(ch);
+        return 1;
+    }
+};
+
+/**
+ * @brief Collects output in memory
+ *
+ */
+class string_sink : public output_sink {
+    std::string contents;
+
+   public:
+    void write(char const* data, size_t size) override {
+        contents.append(data, size);
+    }
+    std::string const& str() const { return contents; }
+};
+
+/**
+ * @brief Throws away output
+ *
+ */
+class null_sink : public output_sink {
+   public:
+    void write(char const*, size_t) override {}
+};
+
+class string_source : public input_source {
+    std::string contents;
+    size_t position = 0;
+
+   public:
+    explicit string_source(std::string contents)
+      : contents(std::move(contents)) {}
+    size_t read(char* data, size_t size) override {
+        size_t count = std::min(size, contents.size() - position);
+        std::memcpy(data, contents.data() + position, count);
+        position += count;
+        return count;
+    }
+};
+
+/**
+ * @brief Input supplied by the program embedding the machine, as it arrives.
+ * While it's empty, machine::run_for() stops before op 11 and reports that
+ * the machine needs input, so nothing ever waits for it. Reading it while
+ * it's empty (with an engine that doesn't check) gives the end of the input
+ *
+ */
+class queued_source : public input_source {
+    std::string pending;
+    size_t position = 0;
+    bool closed = false;
+
+   public:
+    void push(std::string_view data) {
+        pending.erase(0, position);
+        position = 0;
+        pending.append(data);
+    }
+    // Marks the end of the input, which op 11 reads once the rest is gone
+    void close() { closed = true; }
+    size_t read(char* data, size_t size) override {
+        size_t count = std::min(size, pending.size() - position);
+        std::memcpy(data, pending.data() + position, count);
+        position += count;
+        return count;
+    }
+    bool ready() const override { return position < pending.size() || closed; }
+};
+
+/**
+ * @brief Passes output to a function, a buffer at a time
+ *
+ */
+class callback_sink : public output_sink {
+    std::function<void(std::string_view)> callback;
+
+   public:
+    explicit callback_sink(std::function<void(std::string_view)> callback)
+      : callback(std::move(callback)) {}
+    void write(char const* data, size_t size) override {
+        callback(std::string_view(data, size));
+    }
+};
+
+/**
+ * @brief Asks a function for input. The function has the same contract as
+ * input_source::read
+ *
+ */
+class callback_source : public input_source {
+    std::function<size_t(char*, size_t)> callback;
+
+   public:
+    explicit callback_source(std::function<size_t(char*, size_t)> callback)
+      : callback(std::move(callback)) {}
+    size_t read(char* data, size_t size) override {
+        return callback(data, size);
+    }
+};
+
+/**
+ * @brief Hands output off to a dedicated writer thread through a lock-free
+ * single-producer, single-consumer ring, so that the thread running the
+ * machine never waits on the inner sink unless the ring is full or the
+ * output is being flushed. Only one thread may write to it at a time.
+ *
+ */
+class threaded_sink : public output_sink {
+    std::shared_ptr<output_sink> inner;
+    std::unique_ptr<char[]> ring;
+    size_t capacity;
+    // Bytes in [tail, head) are waiting to be written. Both only ever
+    // increase, and are reduced modulo the capacity to index the ring
+    std::atomic<size_t> head {0};
+    std::atomic<size_t> tail {0};
+    std::atomic<bool> sleeping {false};
+    std::atomic<bool> stopping {false};
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread writer;
+
+    void wake_writer() {
+        if (sleeping.load()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            wake.notify_one();
+        }
+    }
+    void run_writer() {
+        for (;;) {
+            size_t t = tail.load(std::memory_order_relaxed);
+            size_t h = head.load(std::memory_order_acquire);
+            if (h == t) {
+                std::unique_lock<std::mutex> lock(mutex);
+                sleeping.store(true);
+                wake.wait(lock, [&] {
+                    return head.load() != t || stopping.load();
+                });
+                sleeping.store(false);
+                if (head.load() == t) {
+                    return;
+                }
+                continue;
+            }
+            // Write up to the end of the ring, and pick up the rest on the
+            // next time around
+            size_t start = t % capacity;
+            size_t count = std::min(h - t, capacity - start);
+            inner->write(ring.get() + start, count);
+            tail.store(t + count, std::memory_order_release);
+        }
+    }
+
+   public:
+    threaded_sink(std::shared_ptr<output_sink> inner, size_t capacity = 1 << 20)
+      : inner(std::move(inner))
+      , ring(new char[capacity])
+      , capacity(capacity)
+      , writer([this] { run_writer(); }) {}
+    threaded_sink(threaded_sink const&) = delete;
+    threaded_sink& operator=(threaded_sink const&) = delete;
+    ~threaded_sink() override {
+        flush();
+        stopping.store(true);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            wake.notify_one();
+        }
+        writer.join();
+    }
+
+    void write(char const* data, size_t size) override {
+        while (size > 0) {
+            size_t h = head.load(std::memory_order_relaxed);
+            size_t room = capacity - (h - tail.load(std::memory_order_acquire));
+            if (room == 0) {
+                wake_writer();
+                std::this_thread::yield();
+                continue;
+            }
+            size_t start = h % capacity;
+            size_t count = std::min({size, room, capacity - start});
+            std::memcpy(ring.get() + start, data, count);
+            // Sequentially consistent, so that the writer can't miss it while
+            // it's going to sleep
+            head.store(h + count);
+            data += count;
+            size -= count;
+        }
+        wake_writer();
+    }
+    // Waits for the writer thread to catch up
+    void flush() override {
+        while (tail.load(std::memory_order_acquire)
+               != head.load(std::memory_order_relaxed)) {
+            wake_writer();
+            std::this_thread::yield();
+        }
+        inner->flush();
+    }
+};
+
+struct console_options {
+    using clock = std::chrono::steady_clock;
+
+    size_t output_buffer = 64 << 10;
+    size_t input_buffer = 64 << 10;
+    // The longest output may sit in the buffer while more output keeps
+    // coming. This is checked at the end of each line and every
+    // delay_check_interval bytes, since reading the clock on every byte would
+    // cost more than the buffering saves, so it doesn't bound output that's
+    // followed by a long computation with none; output is still drained
+    // before reading input and when the machine halts. Zero turns the check
+    // off
+    clock::duration max_delay = std::chrono::milliseconds(50);
+    size_t delay_check_interval = 256;
+};
+
+/**
+ * @brief The console of a machine, which ops 10 and 11 go through. Output is
+ * collected in a buffer, which is passed to the sink when it fills up, before
+ * reading input, and when the machine halts. It's also passed on if the
+ * oldest byte in it has waited for max_delay, as of the next time that gets
+ * checked (see console_options).
+ * Input is read from the source a buffer at a time.
+ *
+ */
+class console {
+   public:
+    using clock = console_options::clock;
+    using options = console_options;
+
+   private:
+    std::shared_ptr<output_sink> sink;
+    std::shared_ptr<input_source> source;
+    std::vector<char> output;
+    size_t output_size = 0;
+    std::vector<char> input;
+    size_t input_position = 0;
+    size_t input_size = 0;
+    clock::duration max_delay;
+    size_t delay_check_interval;
+    // Roughly when the oldest byte in the buffer was written: it's the time
+    // of the first check since the buffer was last drained. timing is false
+    // until that check happens
+    clock::time_point oldest_output;
+    bool timing = false;
+
+    // Passes the buffered output to the sink, without flushing the sink
+    void drain() {
+        if (output_size != 0) {
+            sink->write(output.data(), output_size);
+            output_size = 0;
+        }
+        timing = false;
+    }
+    // Only called as output is written, so output that's followed by none
+    // stays buffered until the next drain, however long that takes
+    void check_delay() {
+        clock::time_point now = clock::now();
+        if (!timing) {
+            oldest_output = now;
+            timing = true;
+        } else if (now - oldest_output >= max_delay) {
+            drain();
+        }
+    }
+
+   public:
+    console(
+        std::shared_ptr<output_sink> sink,
+        std::shared_ptr<input_source> source,
+        options opts = {})
+      : sink(std::move(sink))
+      , source(std::move(source))
+      , output(std::max<size_t>(opts.output_buffer, 1))
+      , input(std::max<size_t>(opts.input_buffer, 1))
+      , max_delay(opts.max_delay)
+      , delay_check_interval(std::max<size_t>(opts.delay_check_interval, 1)) {}
+    // A copy would write the buffered output a second time, so consoles can
+    // only be moved
+    console(console const&) = delete;
+    console(console&&) noexcept = default;
+    console& operator=(console const&) = delete;
+    // The output already buffered here goes to this console's sink before
+    // it's replaced
+    console& operator=(console&& other) {
+        if (this != &other) {
+            if (sink) {
+                flush();
+            }
+            sink = std::move(other.sink);
+            source = std::move(other.source);
+            output = std::move(other.output);
+            output_size = std::exchange(other.output_size, 0);
+            input = std::move(other.input);
+            input_position = std::exchange(other.input_position, 0);
+            input_size = std::exchange(other.input_size, 0);
+            max_delay = other.max_delay;
+            delay_check_interval = other.delay_check_interval;
+            oldest_output = other.oldest_output;
+            timing = std::exchange(other.timing, false);
+        }
+        return *this;
+    }
+    ~console() {
+        // A moved-from console has nothing to flush to
+        if (sink) {
+            flush();
+        }
+    }
+
+    /**
+     * @brief A buffered console on standard input and output
+     *
+     */
+    static console standard(options opts = {}) {
+#if COMPILER_HAS_FD_IO
+        return console(
+            std::make_shared<fd_sink>(STDOUT_FILENO),
+            std::make_shared<fd_source>(STDIN_FILENO),
+            opts);
+#else
+        return console(
+            std::make_shared<stdio_sink>(stdout),
+            std::make_shared<stdio_source>(stdin),
+            opts);
+#endif
+    }
+    /**
+     * @brief Like standard(), but output is written by a separate thread
+     *
+     */
+    static console threaded(options opts = {}) {
+        console result = standard(opts);
+        result.sink = std::make_shared<threaded_sink>(result.sink);
+        return result;
+    }
+    /**
+     * @brief Reads and writes a byte at a time through stdio, with no
+     * buffering beyond what stdio does itself
+     *
+     */
+    static console compatible() {
+        return console(
+            std::make_shared<stdio_sink>(stdout),
+            std::make_shared<stdio_source>(stdin),
+            options {1, 1, clock::duration::zero(), 1});
+    }
+
+    void put(char c) {
+        output[output_size++] = c;
+        if (output_size == output.size()) {
+            drain();
+        } else if (
+            (c == '\n' || output_size % delay_check_interval == 0)
+            && max_delay != clock::duration::zero()) {
+            check_delay();
+        }
+    }
+    /**
+     * @brief Reads one byte of input, after flushing any pending output
+     *
+     * @return int the byte, or EOF at the end of the input
+     */
+    int get() {
+        flush();
+        if (input_position == input_size) {
+            input_size = source->read(input.data(), input.size());
+            input_position = 0;
+            if (input_size == 0) {
+                return EOF;
+            }
+        }
+        return (unsigned char)input[input_position++];
+    }
+    /**
+     * @brief True if get() can return without waiting for input
+     *
+     */
+    bool input_ready() const {
+        return input_position < input_size || source->ready();
+    }
+    /**
+     * @brief Delivers all pending output
+     *
+     */
+    void flush() {
+        drain();
+        sink->flush();
+    }
+};
+} // namespace compiler
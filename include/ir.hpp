@@ -0,0 +1,989 @@
+#pragma once
+
+#include <algorithm>
+#include <initializer_list>
+#include <machine.hpp>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace compiler {
+namespace ir {
+/**
+ * @brief The operations of the IR. Each operation that produces a value
+ * writes it to its own slot, so within a block every slot is written once.
+ * The `_imm` forms take their second operand from the immediate instead of a
+ * slot
+ *
+ */
+enum class code : uint8_t {
+    add,
+    add_imm,
+    mul,
+    mul_imm,
+    div,
+    // Division by a power of two
+    div_shift,
+    // Division by any other constant, as a multiplication (see magic_divisor)
+    div_magic,
+    nand,
+    nand_imm,
+    bit_not,
+    bit_and,
+    and_imm,
+    bit_or,
+    or_imm,
+    bit_xor,
+    cmov,
+    load,
+    store,
+    alloc,
+    free,
+    output,
+    input,
+    // Every block ends with one of these
+    go,
+    branch,
+    jump,
+    load_program,
+    halt,
+    // Traces leave through these when a run goes differently from the one
+    // that was recorded
+    guard,
+    guard_equal,
+};
+
+/**
+ * @brief An operation. Operands a, b and c are slots, apart from the shift of
+ * div_magic and the exit a branch takes when its condition is 0, which are
+ * kept in b, and whether a guard expects a nonzero value, which is kept in c.
+ * For stores, guards and the operations that end a block, imm is the index of
+ * the exit to take
+ *
+ */
+struct op {
+    code kind;
+    uint16_t dst = 0;
+    uint16_t a = 0;
+    uint16_t b = 0;
+    uint16_t c = 0;
+    uint imm = 0;
+};
+
+/**
+ * @brief The machine registers that have to be written when leaving a block
+ * at a given point, and the position in array 0 to carry on from. Registers
+ * that still hold the value they had when the block was entered are left
+ * alone
+ *
+ */
+struct exit_state {
+    uint pc = 0;
+    uint8_t count = 0;
+    // True if a register is written with the value another register had when
+    // the block was entered, which has to be read before it's overwritten
+    bool permutes = false;
+    uint8_t regs[8] {};
+    uint16_t slots[8] {};
+};
+
+/**
+ * @brief A translated block, or a trace, which is translated from several
+ * blocks
+ *
+ */
+struct block {
+    // Where the block is entered
+    uint entry = 0;
+    // The positions in array 0 it was translated from, as first and last
+    std::vector<std::pair<uint, uint>> ranges;
+    bool trace = false;
+    std::vector<op> ops;
+    std::vector<exit_state> exits;
+
+    bool covers(uint pc) const {
+        for (auto [first, last] : ranges) {
+            if (first <= pc && pc <= last) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+/**
+ * @brief Constants for dividing any 32-bit value by d with a multiplication,
+ * for divisors that aren't powers of two (Granlund and Montgomery, "Division
+ * by Invariant Integers using Multiplication", figure 4.1):
+ *
+ *     t = (multiplier * n) >> 32
+ *     n / d = (t + ((n - t) >> 1)) >> shift
+ *
+ */
+struct magic_divisor {
+    uint multiplier;
+    uint shift;
+
+    static magic_divisor of(uint d) {
+        // l = ceil(log2(d)), which is at least 2
+        uint l = 32 - __builtin_clz(d - 1);
+        uint64_t multiplier = (uint64_t(1) << 32)
+                                * ((uint64_t(1) << l) - d) / d
+                            + 1;
+        return {uint(multiplier), l - 1};
+    }
+};
+
+/**
+ * @brief Slots holding constants, shared by every block. They come after the
+ * slots used within a block, and are written once, when the constant is
+ * first needed, so blocks never spend any operations on loading constants
+ *
+ */
+class constant_pool {
+    std::vector<uint>& values;
+    std::unordered_map<uint, uint16_t> slots;
+
+   public:
+    // Slots below this hold the machine registers and the values computed
+    // within a block or trace, which is at most one for each instruction
+    static constexpr uint first_slot = 4096;
+    static constexpr uint slot_count = 1 << 16;
+
+    constant_pool(std::vector<uint>& values)
+      : values(values) {}
+
+    uint16_t get(uint n) {
+        auto [it, added] = slots.try_emplace(
+            n,
+            uint16_t(first_slot + slots.size()));
+        if (added) {
+            if (values.size() <= it->second) {
+                values.resize(std::min<size_t>(values.size() * 2, slot_count));
+            }
+            values[it->second] = n;
+        }
+        return it->second;
+    }
+    static bool holds(uint16_t slot) { return slot >= first_slot; }
+    uint value(uint16_t slot) const { return values[slot]; }
+    // True if a block with the given number of instructions might not fit
+    bool nearly_full(uint instructions) const {
+        return first_slot + slots.size() + 3 * instructions > slot_count;
+    }
+    void clear() { slots.clear(); }
+};
+
+/**
+ * @brief Translates one basic block into the IR. Machine registers are
+ * tracked as values, which are either constants known while translating or
+ * slots, so moves and op 13 never produce any operations. Arithmetic on
+ * constants is folded, the NAND sequences that programs use for NOT, AND, OR
+ * and XOR become single operations, and division by a constant becomes a
+ * shift or a multiplication. Op 0 with a known condition becomes a move,
+ * and a jump to one of two constants picked by op 0 becomes a branch.
+ * Finally, operations whose results are never used are removed.
+ *
+ */
+class translator {
+    struct value {
+        bool constant;
+        uint n;
+
+        bool operator==(value const& other) const {
+            return constant == other.constant && n == other.n;
+        }
+        bool operator!=(value const& other) const { return !(*this == other); }
+    };
+    // How each slot was computed, for recognizing idioms
+    struct definition {
+        code kind;
+        uint16_t a = 0;
+        uint16_t b = 0;
+        uint16_t c = 0;
+        uint imm = 0;
+    };
+
+    block& b;
+    constant_pool& pool;
+    value regs[8];
+    std::vector<definition> defs;
+
+    static value known(uint n) { return {true, n}; }
+    static value var(uint16_t slot) { return {false, slot}; }
+
+    uint16_t define(
+        code kind,
+        uint16_t a = 0,
+        uint16_t b_ = 0,
+        uint16_t c = 0,
+        uint imm = 0) {
+        auto slot = uint16_t(defs.size());
+        defs.push_back(definition {kind, a, b_, c, imm});
+        b.ops.push_back(op {kind, slot, a, b_, c, imm});
+        return slot;
+    }
+    void effect(code kind, uint16_t a = 0, uint16_t b_ = 0, uint imm = 0) {
+        b.ops.push_back(op {kind, 0, a, b_, 0, imm});
+    }
+    // Returns a slot holding the value
+    uint16_t slot(value v) {
+        return v.constant ? pool.get(v.n) : uint16_t(v.n);
+    }
+    definition def(uint16_t slot) const {
+        // Loads are never part of an idiom, so they stand in for constants
+        return slot < defs.size() ? defs[slot] : definition {code::load};
+    }
+    uint exit(uint pc) {
+        exit_state e;
+        e.pc = pc;
+        for (uint r = 0; r < 8; r++) {
+            if (regs[r] != var(uint16_t(r))) {
+                e.regs[e.count] = uint8_t(r);
+                e.slots[e.count] = slot(regs[r]);
+                e.permutes = e.permutes || e.slots[e.count] < 8;
+                e.count++;
+            }
+        }
+        b.exits.push_back(e);
+        return uint(b.exits.size() - 1);
+    }
+
+    value add(value x, value y) {
+        if (x.constant && y.constant) {
+            return known(x.n + y.n);
+        }
+        if (x.constant) {
+            std::swap(x, y);
+        }
+        if (y.constant) {
+            if (y.n == 0) {
+                return x;
+            }
+            return var(define(code::add_imm, slot(x), 0, 0, y.n));
+        }
+        return var(define(code::add, slot(x), slot(y)));
+    }
+    value mul(value x, value y) {
+        if (x.constant && y.constant) {
+            return known(x.n * y.n);
+        }
+        if (x.constant) {
+            std::swap(x, y);
+        }
+        if (y.constant) {
+            if (y.n == 0) {
+                return known(0);
+            }
+            if (y.n == 1) {
+                return x;
+            }
+            return var(define(code::mul_imm, slot(x), 0, 0, y.n));
+        }
+        return var(define(code::mul, slot(x), slot(y)));
+    }
+    value div(value x, value y) {
+        // Division by 0 is left for the machine to fault on
+        if (y.constant && y.n != 0) {
+            if (x.constant) {
+                return known(x.n / y.n);
+            }
+            if (y.n == 1) {
+                return x;
+            }
+            if ((y.n & (y.n - 1)) == 0) {
+                uint shift = __builtin_ctz(y.n);
+                return var(define(code::div_shift, slot(x), 0, 0, shift));
+            }
+            magic_divisor magic = magic_divisor::of(y.n);
+            return var(define(
+                code::div_magic,
+                slot(x),
+                uint16_t(magic.shift),
+                0,
+                magic.multiplier));
+        }
+        return var(define(code::div, slot(x), slot(y)));
+    }
+    value bit_not(value x) {
+        if (x.constant) {
+            return known(~x.n);
+        }
+        definition d = def(uint16_t(x.n));
+        switch (d.kind) {
+            case code::bit_not: return var(d.a);
+            case code::nand: return var(define(code::bit_and, d.a, d.b));
+            case code::nand_imm:
+                return var(define(code::and_imm, d.a, 0, 0, d.imm));
+            case code::bit_and: return var(define(code::nand, d.a, d.b));
+            case code::and_imm:
+                return var(define(code::nand_imm, d.a, 0, 0, d.imm));
+            default: return var(define(code::bit_not, slot(x)));
+        }
+    }
+    value nand(value x, value y) {
+        if (x.constant && y.constant) {
+            return known(~(x.n & y.n));
+        }
+        if (x == y) {
+            return bit_not(x);
+        }
+        if (x.constant) {
+            std::swap(x, y);
+        }
+        if (y.constant) {
+            if (y.n == ~0u) {
+                return bit_not(x);
+            }
+            if (y.n == 0) {
+                return known(~0u);
+            }
+            // ~(~p & k) is p | ~k
+            definition d = def(uint16_t(x.n));
+            if (d.kind == code::bit_not) {
+                return var(define(code::or_imm, d.a, 0, 0, ~y.n));
+            }
+            return var(define(code::nand_imm, slot(x), 0, 0, y.n));
+        }
+        definition dx = def(uint16_t(x.n));
+        definition dy = def(uint16_t(y.n));
+        if (dx.kind == code::bit_not && dy.kind == code::bit_not) {
+            return var(define(code::bit_or, dx.a, dy.a));
+        }
+        // ~(~(p & t) & ~(q & t)) with t = ~(p & q) is p ^ q
+        if (dx.kind == code::nand && dy.kind == code::nand) {
+            for (uint16_t t : {dx.a, dx.b}) {
+                if (t != dy.a && t != dy.b) {
+                    continue;
+                }
+                uint16_t p = t == dx.a ? dx.b : dx.a;
+                uint16_t q = t == dy.a ? dy.b : dy.a;
+                definition dt = def(t);
+                if (dt.kind == code::nand
+                    && ((dt.a == p && dt.b == q) || (dt.a == q && dt.b == p))) {
+                    return var(define(code::bit_xor, p, q));
+                }
+            }
+        }
+        return var(define(code::nand, slot(x), slot(y)));
+    }
+    value cmov(value a, value b_, value c) {
+        if (c.constant) {
+            return c.n != 0 ? b_ : a;
+        }
+        if (a == b_) {
+            return a;
+        }
+        return var(define(code::cmov, slot(a), slot(b_), slot(c)));
+    }
+
+    /**
+     * @brief Ends the block with a two-way branch if the target in the given
+     * register was picked by op 0 from two constants, which is how programs
+     * branch. Each way leaves the register holding its own target
+     *
+     */
+    bool branch(uint reg) {
+        definition d = def(uint16_t(regs[reg].n));
+        if (d.kind != code::cmov || !pool.holds(d.a) || !pool.holds(d.b)) {
+            return false;
+        }
+        regs[reg] = known(pool.value(d.b));
+        uint taken = exit(regs[reg].n);
+        regs[reg] = known(pool.value(d.a));
+        uint not_taken = exit(regs[reg].n);
+        b.ops.push_back(
+            op {code::branch, 0, d.c, uint16_t(not_taken), 0, taken});
+        return true;
+    }
+
+    // The slots read by each kind of operation: a, then b, then c
+    static uint operand_count(code kind) {
+        switch (kind) {
+            case code::input:
+            case code::go:
+            case code::halt: return 0;
+            case code::add_imm:
+            case code::mul_imm:
+            case code::div_shift:
+            case code::div_magic:
+            case code::nand_imm:
+            case code::bit_not:
+            case code::and_imm:
+            case code::or_imm:
+            case code::alloc:
+            case code::free:
+            case code::output:
+            case code::branch:
+            case code::jump:
+            case code::guard: return 1;
+            case code::cmov:
+            case code::store: return 3;
+            default: return 2;
+        }
+    }
+    static bool has_effect(code kind) {
+        switch (kind) {
+            case code::store:
+            case code::alloc:
+            case code::free:
+            case code::output:
+            case code::input:
+            case code::go:
+            case code::branch:
+            case code::jump:
+            case code::load_program:
+            case code::halt:
+            case code::guard:
+            case code::guard_equal: return true;
+            default: return false;
+        }
+    }
+
+   public:
+    translator(block& b, constant_pool& pool)
+      : b(b)
+      , pool(pool) {
+        // Registers hold unknown values when the block is entered
+        for (uint r = 0; r < 8; r++) {
+            regs[r] = var(uint16_t(r));
+            defs.push_back(definition {code::load});
+        }
+    }
+
+    /**
+     * @brief Translates the instruction at pc, and returns true if it ends
+     * the block
+     *
+     */
+    bool translate(uint pc, instruction i) {
+        value& a = regs[i.get_A()];
+        value& b_ = regs[i.get_B()];
+        value& c = regs[i.get_C()];
+        switch (i.get_OP()) {
+            case 0: a = cmov(a, b_, c); return false;
+            case 1: a = var(define(code::load, slot(b_), slot(c))); return false;
+            case 2: {
+                uint16_t array = slot(a), offset = slot(b_), stored = slot(c);
+                // Only stores into array 0 can leave the block
+                b.ops.push_back(op {
+                    code::store,
+                    0,
+                    array,
+                    offset,
+                    stored,
+                    a.constant && a.n != 0 ? 0 : exit(pc + 1)});
+                return false;
+            }
+            case 3: a = add(b_, c); return false;
+            case 4: a = mul(b_, c); return false;
+            case 5: a = div(b_, c); return false;
+            case 6: a = nand(b_, c); return false;
+            case 7: halt(pc); return true;
+            case 8: b_ = var(define(code::alloc, slot(c))); return false;
+            case 9: effect(code::free, slot(c)); return false;
+            case 10: effect(code::output, slot(c)); return false;
+            case 11: c = var(define(code::input)); return false;
+            case 12:
+                if (b_ == known(0) && c.constant) {
+                    go(c.n);
+                } else if (b_ == known(0)) {
+                    if (!branch(i.get_C())) {
+                        effect(code::jump, slot(c), 0, exit(pc));
+                    }
+                } else {
+                    uint16_t array = slot(b_), target = slot(c);
+                    effect(code::load_program, array, target, exit(pc));
+                }
+                return true;
+            case 13:
+                regs[i.get_special()] = known(i.get_special_value());
+                return false;
+            default: return false;
+        }
+    }
+    /**
+     * @brief Translates the op 12 at pc as a jump to next, for traces, where
+     * next is where the recorded run went. Guards leave the trace if a later
+     * run goes elsewhere: a jump picked by op 0 from two constants is guarded
+     * on the condition, and leaves straight for the other constant, and any
+     * other jump is guarded on its target. Returns false for op 12s that
+     * always load a program
+     *
+     */
+    bool follow(uint pc, instruction i, uint next) {
+        value& b_ = regs[i.get_B()];
+        value& c = regs[i.get_C()];
+        if (b_.constant && b_.n != 0) {
+            return false;
+        }
+        if (!b_.constant) {
+            // Leave for the op 12 itself if it would load a program
+            effect(code::guard, slot(b_), 0, exit(pc));
+            b_ = known(0);
+        }
+        if (c.constant) {
+            return c.n == next;
+        }
+        definition d = def(uint16_t(c.n));
+        if (d.kind == code::cmov && pool.holds(d.a) && pool.holds(d.b)
+            && pool.value(d.a) != pool.value(d.b)
+            && (pool.value(d.a) == next || pool.value(d.b) == next)) {
+            bool taken = pool.value(d.b) == next;
+            c = known(pool.value(taken ? d.a : d.b));
+            b.ops.push_back(
+                op {code::guard, 0, d.c, 0, uint16_t(taken), exit(c.n)});
+        } else {
+            uint16_t target = slot(c);
+            b.ops.push_back(op {
+                code::guard_equal,
+                0,
+                target,
+                pool.get(next),
+                0,
+                exit(pc)});
+        }
+        c = known(next);
+        return true;
+    }
+    // Ends the block by carrying on at pc
+    void go(uint pc) { effect(code::go, 0, 0, exit(pc)); }
+    void halt(uint pc) { effect(code::halt, 0, 0, exit(pc)); }
+
+    /**
+     * @brief Removes operations that don't affect anything, once the block
+     * has been translated
+     *
+     */
+    void finish() {
+        std::vector<bool> live(defs.size());
+        for (exit_state const& e : b.exits) {
+            for (uint i = 0; i < e.count; i++) {
+                if (e.slots[i] < live.size()) {
+                    live[e.slots[i]] = true;
+                }
+            }
+        }
+        std::vector<op> kept;
+        for (size_t i = b.ops.size(); i-- > 0;) {
+            op const& o = b.ops[i];
+            if (!has_effect(o.kind) && !live[o.dst]) {
+                continue;
+            }
+            uint16_t const operands[3] {o.a, o.b, o.c};
+            for (uint k = 0; k < operand_count(o.kind); k++) {
+                if (operands[k] < live.size()) {
+                    live[operands[k]] = true;
+                }
+            }
+            kept.push_back(o);
+        }
+        std::reverse(kept.begin(), kept.end());
+        b.ops = std::move(kept);
+    }
+};
+} // namespace ir
+
+/**
+ * @brief Runs the machine by translating each basic block of array 0 into the
+ * IR the first time it's reached, optimizing it (see ir::translator), and
+ * interpreting the result. The machine registers live in the first eight
+ * slots while a block runs.
+ *
+ * With tracing, the tier also counts the jumps back to each position. Once a
+ * loop is hot, the blocks of its next iteration are recorded, and translated
+ * together into a single trace with guards where the jumps between them were
+ * (see ir::translator::follow()), so values are tracked and optimized across
+ * those jumps. The trace then runs in place of the block it starts at, until
+ * a guard fails. Positions that traces often leave for get traces too, which
+ * end where they reach another trace.
+ *
+ * Like the jit, translations are discarded whenever array 0 is replaced, and
+ * a store into array 0 discards every block and trace that covers the word
+ * being written.
+ *
+ */
+class ir_tier {
+    static constexpr uint max_block_length = 256;
+    // Jumps back to a position before a trace is recorded from it
+    static constexpr uint16_t hot_loop = 64;
+    static constexpr uint max_trace_length = 2048;
+    static_assert(
+        8 + max_trace_length <= ir::constant_pool::first_slot
+            && 8 + max_block_length <= ir::constant_pool::first_slot,
+        "the slots of a trace would run into the constant pool");
+
+    machine& m;
+    bool tracing;
+    std::vector<ir::block*> entries;
+    std::vector<uint> coverage;
+    std::vector<std::unique_ptr<ir::block>> blocks;
+    std::vector<uint> values;
+    ir::constant_pool constants;
+    // Jumps back to each position. Positions where recording a trace failed
+    // are left above hot_loop, so they aren't retried until the count wraps
+    std::vector<uint16_t> heat;
+    // The entries of the blocks run since recording started, beginning with
+    // the one the trace starts at. Empty when not recording
+    std::vector<uint> path;
+    // Counts the times translations were discarded, which stops recording
+    uint generation = 0;
+    uint path_generation = 0;
+
+    void flush() {
+        entries.assign(m.arrays[0].size(), nullptr);
+        coverage.assign(m.arrays[0].size(), 0);
+        heat.assign(tracing ? m.arrays[0].size() : 0, 0);
+        blocks.clear();
+        generation++;
+    }
+
+    void invalidate(uint offset) {
+        auto covers = [=](std::unique_ptr<ir::block> const& b) {
+            return b->covers(offset);
+        };
+        for (auto const& b : blocks) {
+            if (covers(b)) {
+                if (entries[b->entry] == b.get()) {
+                    entries[b->entry] = nullptr;
+                }
+                for (auto [first, last] : b->ranges) {
+                    for (uint pc = first; pc <= last; pc++) {
+                        coverage[pc]--;
+                    }
+                }
+            }
+        }
+        blocks.erase(
+            std::remove_if(blocks.begin(), blocks.end(), covers),
+            blocks.end());
+        generation++;
+    }
+
+    ir::block* add(std::unique_ptr<ir::block> b) {
+        for (auto [first, last] : b->ranges) {
+            for (uint pc = first; pc <= last; pc++) {
+                coverage[pc]++;
+            }
+        }
+        entries[b->entry] = b.get();
+        blocks.push_back(std::move(b));
+        return blocks.back().get();
+    }
+
+    // Translates the block starting at pc, which has to be inside array 0
+    ir::block* compile(uint pc) {
+        if (constants.nearly_full(max_block_length)) {
+            flush();
+            constants.clear();
+        }
+        uint program_size = uint(m.arrays[0].size());
+        auto b = std::make_unique<ir::block>();
+        ir::translator t(*b, constants);
+        uint end = pc;
+        for (;; end++) {
+            if (end >= program_size) {
+                // Running off the end of the program stops the machine
+                t.halt(end);
+                break;
+            }
+            if (end - pc == max_block_length) {
+                t.go(end);
+                break;
+            }
+            if (t.translate(end, m.get_instruction(end))) {
+                break;
+            }
+        }
+        t.finish();
+        b->entry = pc;
+        b->ranges.emplace_back(pc, std::min(end, program_size - 1));
+        return add(std::move(b));
+    }
+
+    bool has_trace(uint pc) const { return entries[pc] && entries[pc]->trace; }
+
+    /**
+     * @brief Translates the recorded path into a trace that carries on at end,
+     * going through the same instructions as the blocks that ran, and
+     * installs it in place of the block at the start of the path. Paths that
+     * halt, load a program, or don't fit in a trace are dropped
+     *
+     */
+    void compile_trace(uint end) {
+        if (constants.nearly_full(max_trace_length)) {
+            return;
+        }
+        uint program_size = uint(m.arrays[0].size());
+        auto b = std::make_unique<ir::block>();
+        ir::translator t(*b, constants);
+        uint length = 0;
+        for (size_t k = 0; k < path.size(); k++) {
+            uint next = k + 1 < path.size() ? path[k + 1] : end;
+            uint pc = path[k];
+            for (;; pc++) {
+                if (pc == path[k] + max_block_length) {
+                    // The block carried on at the next position
+                    if (pc != next) {
+                        return;
+                    }
+                    pc--;
+                    break;
+                }
+                if (pc >= program_size || ++length > max_trace_length) {
+                    return;
+                }
+                instruction i = m.get_instruction(pc);
+                if (i.get_OP() == 12) {
+                    if (!t.follow(pc, i, next)) {
+                        return;
+                    }
+                    break;
+                }
+                if (t.translate(pc, i)) {
+                    return;
+                }
+            }
+            b->ranges.emplace_back(path[k], pc);
+        }
+        t.go(end);
+        t.finish();
+        b->entry = path[0];
+        b->trace = true;
+        add(std::move(b));
+    }
+
+    // Called after each block or trace runs while tracing, with where it was
+    // entered and where execution carries on
+    void trace_jump(uint from, uint pc, bool was_trace) {
+        if (!path.empty()) {
+            if (generation != path_generation
+                || path.size() == max_trace_length) {
+                path.clear();
+            } else if (pc == path[0] || has_trace(pc)) {
+                compile_trace(pc);
+                path.clear();
+            } else {
+                path.push_back(pc);
+            }
+            return;
+        }
+        // Loops are found from the jumps back to them. Where traces are
+        // often left for gets a trace of its own, which carries on until it
+        // reaches a trace
+        bool hot = was_trace ? pc != from : pc <= from;
+        if (hot && !has_trace(pc) && ++heat[pc] == hot_loop) {
+            path.assign(1, pc);
+            path_generation = generation;
+        }
+    }
+
+    // Writes the registers that changed in the block
+    void leave(ir::exit_state const& e) {
+        uint* v = values.data();
+        if (!e.permutes) {
+            for (uint i = 0; i < e.count; i++) {
+                v[e.regs[i]] = v[e.slots[i]];
+            }
+            return;
+        }
+        uint out[8];
+        for (uint i = 0; i < e.count; i++) {
+            out[i] = v[e.slots[i]];
+        }
+        for (uint i = 0; i < e.count; i++) {
+            v[e.regs[i]] = out[i];
+        }
+    }
+
+    // Runs a block, setting pc to where execution carries on. Returns false
+    // if the machine halted. With computed goto, each operation jumps
+    // straight to the handler for the next one
+    bool execute(ir::block const& b, uint& pc) {
+        using ir::code;
+        uint* v = values.data();
+        ir::op const* o = b.ops.data();
+#if COMPILER_HAS_COMPUTED_GOTO
+        // In the same order as ir::code
+        static void* const labels[] {
+            &&op_add,
+            &&op_add_imm,
+            &&op_mul,
+            &&op_mul_imm,
+            &&op_div,
+            &&op_div_shift,
+            &&op_div_magic,
+            &&op_nand,
+            &&op_nand_imm,
+            &&op_bit_not,
+            &&op_bit_and,
+            &&op_and_imm,
+            &&op_bit_or,
+            &&op_or_imm,
+            &&op_bit_xor,
+            &&op_cmov,
+            &&op_load,
+            &&op_store,
+            &&op_alloc,
+            &&op_free,
+            &&op_output,
+            &&op_input,
+            &&op_go,
+            &&op_branch,
+            &&op_jump,
+            &&op_load_program,
+            &&op_halt,
+            &&op_guard,
+            &&op_guard_equal};
+#define IR_OP(name) op_##name
+#define IR_NEXT() goto* labels[size_t((++o)->kind)]
+        goto* labels[size_t(o->kind)];
+        {
+#else
+#define IR_OP(name) case code::name
+#define IR_NEXT()                                                              \
+    {                                                                          \
+        o++;                                                                   \
+        continue;                                                              \
+    }
+        for (;;) switch (o->kind) {
+#endif
+            IR_OP(add): v[o->dst] = v[o->a] + v[o->b]; IR_NEXT();
+            IR_OP(add_imm): v[o->dst] = v[o->a] + o->imm; IR_NEXT();
+            IR_OP(mul): v[o->dst] = v[o->a] * v[o->b]; IR_NEXT();
+            IR_OP(mul_imm): v[o->dst] = v[o->a] * o->imm; IR_NEXT();
+            IR_OP(div): v[o->dst] = v[o->a] / v[o->b]; IR_NEXT();
+            IR_OP(div_shift): v[o->dst] = v[o->a] >> o->imm; IR_NEXT();
+            IR_OP(div_magic): {
+                uint n = v[o->a];
+                uint t = uint((uint64_t(o->imm) * n) >> 32);
+                v[o->dst] = (t + ((n - t) >> 1)) >> o->b;
+            }
+            IR_NEXT();
+            IR_OP(nand): v[o->dst] = ~(v[o->a] & v[o->b]); IR_NEXT();
+            IR_OP(nand_imm): v[o->dst] = ~(v[o->a] & o->imm); IR_NEXT();
+            IR_OP(bit_not): v[o->dst] = ~v[o->a]; IR_NEXT();
+            IR_OP(bit_and): v[o->dst] = v[o->a] & v[o->b]; IR_NEXT();
+            IR_OP(and_imm): v[o->dst] = v[o->a] & o->imm; IR_NEXT();
+            IR_OP(bit_or): v[o->dst] = v[o->a] | v[o->b]; IR_NEXT();
+            IR_OP(or_imm): v[o->dst] = v[o->a] | o->imm; IR_NEXT();
+            IR_OP(bit_xor): v[o->dst] = v[o->a] ^ v[o->b]; IR_NEXT();
+            IR_OP(cmov):
+                v[o->dst] = v[o->c] != 0 ? v[o->b] : v[o->a];
+                IR_NEXT();
+            IR_OP(load): v[o->dst] = m.load(v[o->a], v[o->b]); IR_NEXT();
+            IR_OP(store): {
+                uint array = v[o->a], offset = v[o->b];
+                m.store(array, offset, v[o->c]);
+                if (array == 0 && coverage[offset] != 0) {
+                    // This block may be one of the ones discarded, so leave
+                    // it before discarding anything
+                    leave(b.exits[o->imm]);
+                    pc = b.exits[o->imm].pc;
+                    invalidate(offset);
+                    return true;
+                }
+            }
+            IR_NEXT();
+            IR_OP(alloc): v[o->dst] = m.allocate(v[o->a]); IR_NEXT();
+            IR_OP(free): m.deallocate(v[o->a]); IR_NEXT();
+            IR_OP(output): m.print_char(char(v[o->a])); IR_NEXT();
+            IR_OP(input): v[o->dst] = m.read_char(); IR_NEXT();
+            IR_OP(go): {
+                leave(b.exits[o->imm]);
+                pc = b.exits[o->imm].pc;
+                return true;
+            }
+            IR_OP(branch): {
+                auto const& e = b.exits[v[o->a] != 0 ? o->imm : o->b];
+                leave(e);
+                pc = e.pc;
+                return true;
+            }
+            IR_OP(jump): {
+                uint target = v[o->a];
+                leave(b.exits[o->imm]);
+                pc = target;
+                return true;
+            }
+            IR_OP(load_program): {
+                uint array = v[o->a], target = v[o->b];
+                leave(b.exits[o->imm]);
+                if (array != 0) {
+                    m.load_program(array);
+                    flush();
+                }
+                pc = target;
+                return true;
+            }
+            IR_OP(halt): {
+                leave(b.exits[o->imm]);
+                return false;
+            }
+            IR_OP(guard): {
+                if ((v[o->a] != 0) == (o->c != 0)) {
+                    IR_NEXT();
+                }
+                leave(b.exits[o->imm]);
+                pc = b.exits[o->imm].pc;
+                return true;
+            }
+            IR_OP(guard_equal): {
+                uint target = v[o->a];
+                if (target == v[o->b]) {
+                    IR_NEXT();
+                }
+                leave(b.exits[o->imm]);
+                pc = target;
+                return true;
+            }
+        }
+#undef IR_OP
+#undef IR_NEXT
+    }
+
+   public:
+    ir_tier(machine& m, bool tracing = false)
+      : m(m)
+      , tracing(tracing)
+      , values(ir::constant_pool::first_slot * 2)
+      , constants(values) {
+        flush();
+    }
+
+    /**
+     * @brief Runs the machine until it halts, starting from its program
+     * counter
+     *
+     */
+    void run() {
+        if (m.halted) {
+            return;
+        }
+        std::copy(m.registers.begin(), m.registers.end(), values.begin());
+        uint pc = m.program_counter;
+        for (;;) {
+            if (pc >= entries.size()) {
+                break;
+            }
+            ir::block* b = entries[pc] ? entries[pc] : compile(pc);
+            uint from = pc;
+            // The block may be discarded while it runs
+            bool was_trace = b->trace;
+            if (!execute(*b, pc)) {
+                break;
+            }
+            if (tracing && pc < entries.size()) {
+                trace_jump(from, pc, was_trace);
+            }
+        }
+        std::copy(values.begin(), values.begin() + 8, m.registers.begin());
+        m.halted = true;
+        m.io.flush();
+    }
+};
+
+inline void run_ir(machine& m) { ir_tier(m).run(); }
+inline void run_trace(machine& m) { ir_tier(m, true).run(); }
+} // namespace compiler
@@ -0,0 +1,795 @@
+#pragma once
+
+#include <machine.hpp>
+
+// The jit emits x86-64 code for the System V calling convention, and it needs
+// mmap in order to obtain executable memory.
+#if defined(__x86_64__) && defined(__unix__)
+#define COMPILER_HAS_JIT 1
+#else
+#define COMPILER_HAS_JIT 0
+#endif
+
+#if COMPILER_HAS_JIT
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <sys/mman.h>
+#endif
+
+namespace compiler {
+#if COMPILER_HAS_JIT
+namespace x64 {
+enum reg : uint8_t {
+    rax,
+    rcx,
+    rdx,
+    rbx,
+    rsp,
+    rbp,
+    rsi,
+    rdi,
+    r8,
+    r9,
+    r10,
+    r11,
+    r12,
+    r13,
+    r14,
+    r15
+};
+enum cond : uint8_t { cond_e = 0x4, cond_ne = 0x5, cond_ae = 0x3 };
+
+/**
+ * @brief Writes x86-64 machine code into a fixed-size block of executable
+ * memory. Only the handful of instruction forms needed by the jit are
+ * supported. Unless marked otherwise, operations act on 32-bit registers.
+ *
+ */
+class emitter {
+    uint8_t* code = nullptr;
+    size_t capacity = 0;
+    size_t length = 0;
+
+    void rex(bool wide, int reg, int index, int base) {
+        uint8_t prefix = 0x40 | (wide << 3) | ((reg >> 3) << 2)
+                       | ((index >> 3) << 1) | (base >> 3);
+        if (prefix != 0x40) {
+            byte(prefix);
+        }
+    }
+    void opcode(std::initializer_list<uint8_t> op) {
+        for (uint8_t b : op) {
+            byte(b);
+        }
+    }
+    // Register-direct operand: mod = 11
+    void op_rr(
+        std::initializer_list<uint8_t> op,
+        int reg,
+        int rm,
+        bool wide = false) {
+        rex(wide, reg, 0, rm);
+        opcode(op);
+        byte(0xC0 | (reg & 7) << 3 | (rm & 7));
+    }
+    // Memory operand of the form [base + disp32]
+    void op_mem(
+        std::initializer_list<uint8_t> op,
+        int reg,
+        int base,
+        int32_t disp,
+        bool wide = false) {
+        rex(wide, reg, 0, base);
+        opcode(op);
+        byte(0x80 | (reg & 7) << 3 | (base & 7));
+        if ((base & 7) == rsp) {
+            byte(0x24);
+        }
+        dword(disp);
+    }
+    // Memory operand of the form [base + index * (1 << scale)]
+    void op_sib(
+        std::initializer_list<uint8_t> op,
+        int reg,
+        int base,
+        int index,
+        int scale,
+        bool wide = false) {
+        rex(wide, reg, index, base);
+        opcode(op);
+        uint8_t sib = scale << 6 | (index & 7) << 3 | (base & 7);
+        if ((base & 7) == rbp) {
+            // rbp and r13 can't be used as a base without a displacement
+            byte(0x44 | (reg & 7) << 3);
+            byte(sib);
+            byte(0);
+        } else {
+            byte(0x04 | (reg & 7) << 3);
+            byte(sib);
+        }
+    }
+
+   public:
+    emitter(size_t capacity)
+      : capacity(capacity) {
+        void* memory = mmap(
+            nullptr,
+            capacity,
+            PROT_READ | PROT_WRITE | PROT_EXEC,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1,
+            0);
+        if (memory == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        code = static_cast<uint8_t*>(memory);
+    }
+    emitter(emitter const&) = delete;
+    emitter& operator=(emitter const&) = delete;
+    ~emitter() { munmap(code, capacity); }
+
+    uint8_t* here() const { return code + length; }
+    size_t size() const { return length; }
+    size_t remaining() const { return capacity - length; }
+    void rewind(size_t new_length) { length = new_length; }
+
+    void byte(uint8_t value) { code[length++] = value; }
+    void dword(uint32_t value) {
+        std::memcpy(code + length, &value, sizeof(value));
+        length += sizeof(value);
+    }
+    void qword(uint64_t value) {
+        std::memcpy(code + length, &value, sizeof(value));
+        length += sizeof(value);
+    }
+
+    void mov(reg dst, reg src) { op_rr({0x89}, src, dst); }
+    void mov64(reg dst, reg src) { op_rr({0x89}, src, dst, true); }
+    void mov(reg dst, uint32_t imm) {
+        rex(false, 0, 0, dst);
+        byte(0xB8 + (dst & 7));
+        dword(imm);
+    }
+    void mov64(reg dst, uint64_t imm) {
+        rex(true, 0, 0, dst);
+        byte(0xB8 + (dst & 7));
+        qword(imm);
+    }
+    void add(reg dst, reg src) { op_rr({0x01}, src, dst); }
+    void add64(reg dst, reg src) { op_rr({0x01}, src, dst, true); }
+    void imul(reg dst, reg src) { op_rr({0x0F, 0xAF}, dst, src); }
+    void imul64(reg dst, reg src, int32_t imm) {
+        op_rr({0x69}, dst, src, true);
+        dword(imm);
+    }
+    void and_(reg dst, reg src) { op_rr({0x21}, src, dst); }
+    void not_(reg dst) { op_rr({0xF7}, 2, dst); }
+    void xor_(reg dst, reg src) { op_rr({0x31}, src, dst); }
+    // Unsigned divide of edx:eax by src
+    void div(reg src) { op_rr({0xF7}, 6, src); }
+    void test(reg a, reg b) { op_rr({0x85}, b, a); }
+    void cmp(reg a, uint32_t imm) {
+        op_rr({0x81}, 7, a);
+        dword(imm);
+    }
+    void cmovne(reg dst, reg src) { op_rr({0x0F, 0x45}, dst, src); }
+
+    void load32(reg dst, reg base, int32_t disp) {
+        op_mem({0x8B}, dst, base, disp);
+    }
+    void load64(reg dst, reg base, int32_t disp) {
+        op_mem({0x8B}, dst, base, disp, true);
+    }
+    void store32(reg base, int32_t disp, reg src) {
+        op_mem({0x89}, src, base, disp);
+    }
+    void store32(reg base, int32_t disp, uint32_t imm) {
+        op_mem({0xC7}, 0, base, disp);
+        dword(imm);
+    }
+    void cmp(reg a, reg base, int32_t disp) { op_mem({0x3B}, a, base, disp); }
+    // Compares [base + disp] against a sign-extended 8-bit value
+    void cmp32(reg base, int32_t disp, int8_t imm) {
+        op_mem({0x83}, 7, base, disp);
+        byte(imm);
+    }
+    // Compares [base + index * 4] against a sign-extended 8-bit value
+    void cmp_indexed32(reg base, reg index, int8_t imm) {
+        op_sib({0x83}, 7, base, index, 2);
+        byte(imm);
+    }
+    // dst = [base + index * 4]
+    void load_indexed32(reg dst, reg base, reg index) {
+        op_sib({0x8B}, dst, base, index, 2);
+    }
+    // [base + index * 4] = src
+    void store_indexed32(reg base, reg index, reg src) {
+        op_sib({0x89}, src, base, index, 2);
+    }
+    // dst = [base + index * 8]
+    void load_indexed64(reg dst, reg base, reg index) {
+        op_sib({0x8B}, dst, base, index, 3, true);
+    }
+
+    void push(reg r) {
+        rex(false, 0, 0, r);
+        byte(0x50 + (r & 7));
+    }
+    void pop(reg r) {
+        rex(false, 0, 0, r);
+        byte(0x58 + (r & 7));
+    }
+    void sub_rsp(int8_t imm) {
+        op_rr({0x83}, 5, rsp, true);
+        byte(imm);
+    }
+    void add_rsp(int8_t imm) {
+        op_rr({0x83}, 0, rsp, true);
+        byte(imm);
+    }
+    void call(reg target) { op_rr({0xFF}, 2, target); }
+    void jmp(reg target) { op_rr({0xFF}, 4, target); }
+    void ret() { byte(0xC3); }
+
+    // Emits a jump with a 32-bit displacement, and returns the location to
+    // pass to patch() once the target is known
+    size_t jmp() {
+        byte(0xE9);
+        dword(0);
+        return length;
+    }
+    size_t jcc(cond c) {
+        byte(0x0F);
+        byte(0x80 | c);
+        dword(0);
+        return length;
+    }
+    void patch(size_t jump, uint8_t const* target) {
+        int32_t displacement = int32_t(target - (code + jump));
+        std::memcpy(code + jump - 4, &displacement, sizeof(displacement));
+    }
+    void jmp(uint8_t const* target) { patch(jmp(), target); }
+};
+} // namespace x64
+
+/**
+ * @brief Translates basic blocks in array 0 into x86-64 code. A block ends at
+ * a halt (op 7), a load program (op 12), or an input (op 11). The eight
+ * registers of the machine are kept in host registers for as long as
+ * execution stays inside translated code, and a jump within array 0 goes
+ * straight to the next block if it has already been translated.
+ *
+ * Translations are discarded whenever array 0 is replaced, and a store into
+ * array 0 discards every block that covers the word being written.
+ *
+ */
+class jit {
+    using reg = x64::reg;
+
+    enum exit_reason : uint32_t {
+        exit_halt,
+        exit_dispatch,
+        exit_input,
+        exit_load,
+        exit_allocate,
+    };
+
+    // Everything the translated code needs to find at runtime. It's kept in
+    // r15 while translated code is running.
+    struct context {
+        void* const* entries = nullptr;
+        uint const* coverage = nullptr;
+        uint32_t entry_count = 0;
+        uint32_t next_pc = 0;
+        uint32_t reason = exit_halt;
+        uint* registers = nullptr;
+        word_array* table = nullptr;
+        jit* self = nullptr;
+    };
+
+    struct block {
+        uint start = 0;
+        uint end = 0;
+    };
+
+    using entry_fn = void (*)(context*, void const*);
+
+    // Machine register i lives in host register host_registers[i]. r8 through
+    // r10 aren't preserved across calls, so they get saved around each helper
+    // call.
+    static constexpr reg host_registers[8] {
+        x64::rbx,
+        x64::rbp,
+        x64::r12,
+        x64::r13,
+        x64::r14,
+        x64::r8,
+        x64::r9,
+        x64::r10};
+    static constexpr reg ctx_reg = x64::r15;
+    static constexpr uint max_block_length = 1024;
+    // More than any one instruction takes, along with the jump that ends its
+    // block. The longest is a store, at about 250 bytes with pointer
+    // identifiers
+    static constexpr size_t max_instruction_bytes = 512;
+
+    machine& m;
+    context ctx;
+    x64::emitter code;
+    std::vector<void*> entries;
+    std::vector<uint> coverage;
+    std::vector<block> blocks;
+
+    entry_fn enter = nullptr;
+    uint8_t const* exit_stub = nullptr;
+    uint8_t const* dispatch_stub = nullptr;
+    size_t preamble_size = 0;
+
+    // Where the data pointer lives inside a word_array. If the layout isn't
+    // the expected one, loads and stores go through helper calls instead
+    bool inline_arrays = false;
+    int32_t data_offset = 0;
+
+    static reg host(uint r) { return host_registers[r]; }
+    static int32_t field(size_t offset) { return int32_t(offset); }
+
+    static bool probe_data_offset(int32_t& offset) {
+        word_array sample(1);
+        for (size_t i = 0; i + sizeof(uint*) <= sizeof(word_array);
+             i += sizeof(uint*)) {
+            uint* stored;
+            std::memcpy(
+                &stored,
+                reinterpret_cast<char const*>(&sample) + i,
+                sizeof(stored));
+            if (stored == sample.data()) {
+                offset = int32_t(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static uint32_t helper_allocate(context* ctx, uint size) {
+        machine& m = ctx->self->m;
+        uint index = m.allocate(size);
+        ctx->table = m.arrays.data();
+        return index;
+    }
+    static void helper_deallocate(context* ctx, uint index) {
+        machine& m = ctx->self->m;
+        m.deallocate(index);
+        // Freeing can trim the table
+        ctx->table = m.arrays.data();
+    }
+    static void helper_output(context* ctx, uint value) {
+        ctx->self->m.print_char(char(value));
+    }
+    static uint32_t helper_load(context* ctx, uint index, uint offset) {
+        return ctx->self->m.load(index, offset);
+    }
+    static void helper_store(
+        context* ctx,
+        uint index,
+        uint offset,
+        uint value) {
+        ctx->self->m.store(index, offset, value);
+    }
+    // Returns 1 if the store discarded any translations
+    static uint32_t helper_store_program(
+        context* ctx,
+        uint offset,
+        uint value) {
+        jit& self = *ctx->self;
+        self.m.store(0, offset, value);
+        if (offset < self.coverage.size() && self.coverage[offset] != 0) {
+            self.invalidate(offset);
+            return 1;
+        }
+        return 0;
+    }
+
+    // Calls fn(ctx, args...), where each argument is a machine register
+    void emit_call(void const* fn, std::initializer_list<uint> args) {
+        static constexpr reg argument_registers[] {
+            x64::rsi,
+            x64::rdx,
+            x64::rcx};
+        code.push(x64::r8);
+        code.push(x64::r9);
+        code.push(x64::r10);
+        code.sub_rsp(8);
+        code.mov64(x64::rdi, ctx_reg);
+        reg const* dst = argument_registers;
+        for (uint r : args) {
+            code.mov(*dst++, host(r));
+        }
+        code.mov64(x64::rax, uint64_t(reinterpret_cast<uintptr_t>(fn)));
+        code.call(x64::rax);
+        code.add_rsp(8);
+        code.pop(x64::r10);
+        code.pop(x64::r9);
+        code.pop(x64::r8);
+    }
+    void emit_exit(uint32_t reason, uint32_t pc) {
+        code.store32(ctx_reg, field(offsetof(context, next_pc)), pc);
+        code.store32(ctx_reg, field(offsetof(context, reason)), reason);
+        code.jmp(exit_stub);
+    }
+    // Continues execution at the pc given in eax
+    void emit_dispatch() { code.jmp(dispatch_stub); }
+    void emit_dispatch(uint32_t pc) {
+        code.mov(x64::rax, pc);
+        emit_dispatch();
+    }
+    // Loads the data pointer of the array identified by machine register r
+    // into rax. Pointer identifiers are already the data pointer
+    void emit_array_data(uint r) {
+        bool pointer_ids = m.arrays.uses_pointer_ids();
+        size_t is_pointer = 0;
+        if (pointer_ids) {
+            code.cmp(host(r), m.arrays.get_pointer_base());
+            is_pointer = code.jcc(x64::cond_ae);
+        }
+        code.load64(x64::rax, ctx_reg, field(offsetof(context, table)));
+        code.mov(x64::rcx, host(r));
+        code.imul64(x64::rcx, x64::rcx, int32_t(sizeof(word_array)));
+        code.add64(x64::rax, x64::rcx);
+        code.load64(x64::rax, x64::rax, data_offset);
+        if (pointer_ids) {
+            size_t done = code.jmp();
+            code.patch(is_pointer, code.here());
+            code.mov(x64::rax, host(r));
+            code.patch(done, code.here());
+        }
+    }
+
+    // Checks that the array whose data pointer is in rax doesn't share its
+    // storage, so it can be written to in place. Returns the jump to patch
+    // with the path for shared arrays
+    size_t emit_check_unshared() {
+        code.cmp32(x64::rax, word_array::refcount_offset, 1);
+        return code.jcc(x64::cond_ne);
+    }
+
+    // Stores the value in register c into array 0 at the offset in register
+    // b. Stores that hit translated code discard the translation, and leave
+    // the current block in case it was one of the ones discarded
+    void emit_program_store(uint pc, uint b, uint c) {
+        using namespace x64;
+        size_t untranslated = 0;
+        if (inline_arrays) {
+            size_t slow_paths[3] {};
+            code.cmp(
+                host(b),
+                ctx_reg,
+                field(offsetof(context, entry_count)));
+            slow_paths[0] = code.jcc(cond_ae);
+            code.load64(rax, ctx_reg, field(offsetof(context, coverage)));
+            code.cmp_indexed32(rax, host(b), 0);
+            slow_paths[1] = code.jcc(cond_ne);
+            code.load64(rax, ctx_reg, field(offsetof(context, table)));
+            code.load64(rax, rax, data_offset);
+            slow_paths[2] = emit_check_unshared();
+            code.store_indexed32(rax, host(b), host(c));
+            untranslated = code.jmp();
+            for (size_t slow_path : slow_paths) {
+                code.patch(slow_path, code.here());
+            }
+        }
+        emit_call(
+            reinterpret_cast<void const*>(&helper_store_program),
+            {b, c});
+        code.test(rax, rax);
+        size_t unchanged = code.jcc(cond_e);
+        emit_dispatch(pc + 1);
+        code.patch(unchanged, code.here());
+        if (inline_arrays) {
+            code.patch(untranslated, code.here());
+        }
+    }
+
+    void emit_preamble() {
+        using namespace x64;
+        static constexpr reg saved[] {rbx, rbp, r12, r13, r14, r15};
+        int32_t registers_field = field(offsetof(context, registers));
+
+        // enter(ctx, target): save callee-saved registers, load the machine
+        // registers, and jump to the target
+        enter = reinterpret_cast<entry_fn>(code.here());
+        for (reg r : saved) {
+            code.push(r);
+        }
+        code.sub_rsp(8);
+        code.mov64(ctx_reg, rdi);
+        code.load64(rax, ctx_reg, registers_field);
+        for (uint r = 0; r < 8; r++) {
+            code.load32(host(r), rax, int32_t(r * sizeof(uint)));
+        }
+        code.jmp(rsi);
+
+        // Store the machine registers and return to the caller of enter()
+        exit_stub = code.here();
+        code.load64(rax, ctx_reg, registers_field);
+        for (uint r = 0; r < 8; r++) {
+            code.store32(rax, int32_t(r * sizeof(uint)), host(r));
+        }
+        code.add_rsp(8);
+        for (size_t i = std::size(saved); i-- > 0;) {
+            code.pop(saved[i]);
+        }
+        code.ret();
+
+        // Jump to the block starting at the pc in eax, or leave translated
+        // code if there isn't one
+        dispatch_stub = code.here();
+        code.cmp(rax, ctx_reg, field(offsetof(context, entry_count)));
+        size_t out_of_range = code.jcc(cond_ae);
+        code.load64(rcx, ctx_reg, field(offsetof(context, entries)));
+        code.load_indexed64(rcx, rcx, rax);
+        code.test(rcx, rcx);
+        size_t missing = code.jcc(cond_e);
+        code.jmp(rcx);
+        code.patch(out_of_range, code.here());
+        code.patch(missing, code.here());
+        code.store32(ctx_reg, field(offsetof(context, next_pc)), rax);
+        code.store32(ctx_reg, field(offsetof(context, reason)), exit_dispatch);
+        code.jmp(exit_stub);
+
+        preamble_size = code.size();
+    }
+
+    // Returns true if the instruction ends the block
+    bool emit_instruction(uint pc, instruction i) {
+        using namespace x64;
+        uint a = i.get_A(), b = i.get_B(), c = i.get_C();
+        switch (i.get_OP()) {
+            case 0:
+                code.test(host(c), host(c));
+                code.cmovne(host(a), host(b));
+                return false;
+            case 1:
+                if (inline_arrays) {
+                    emit_array_data(b);
+                    code.load_indexed32(host(a), rax, host(c));
+                } else {
+                    emit_call(
+                        reinterpret_cast<void const*>(&helper_load),
+                        {b, c});
+                    code.mov(host(a), rax);
+                }
+                return false;
+            case 2: {
+                code.test(host(a), host(a));
+                size_t to_program = code.jcc(cond_e);
+                size_t stored = 0;
+                if (inline_arrays) {
+                    emit_array_data(a);
+                    size_t shared = emit_check_unshared();
+                    code.store_indexed32(rax, host(b), host(c));
+                    stored = code.jmp();
+                    code.patch(shared, code.here());
+                }
+                // Arrays that share their storage get copied by the helper
+                emit_call(
+                    reinterpret_cast<void const*>(&helper_store),
+                    {a, b, c});
+                if (inline_arrays) {
+                    code.patch(stored, code.here());
+                }
+                size_t done = code.jmp();
+                code.patch(to_program, code.here());
+                emit_program_store(pc, b, c);
+                code.patch(done, code.here());
+                return false;
+            }
+            case 3:
+            case 4: {
+                bool is_add = i.get_OP() == 3;
+                auto combine = [&](reg dst, reg src) {
+                    is_add ? code.add(dst, src) : code.imul(dst, src);
+                };
+                if (a == b) {
+                    combine(host(a), host(c));
+                } else if (a == c) {
+                    combine(host(a), host(b));
+                } else {
+                    code.mov(host(a), host(b));
+                    combine(host(a), host(c));
+                }
+                return false;
+            }
+            case 5:
+                code.mov(rax, host(b));
+                code.xor_(rdx, rdx);
+                code.div(host(c));
+                code.mov(host(a), rax);
+                return false;
+            case 6:
+                code.mov(rax, host(b));
+                code.and_(rax, host(c));
+                code.not_(rax);
+                code.mov(host(a), rax);
+                return false;
+            case 7: emit_exit(exit_halt, pc); return true;
+            case 8:
+                // Going over a memory limit throws, which can't unwind
+                // through translated code, so with a limit the allocation
+                // happens outside it
+                if (m.arrays.has_word_limit()) {
+                    emit_exit(exit_allocate, pc);
+                    return true;
+                }
+                emit_call(reinterpret_cast<void const*>(&helper_allocate), {c});
+                code.mov(host(b), rax);
+                return false;
+            case 9:
+                emit_call(
+                    reinterpret_cast<void const*>(&helper_deallocate),
+                    {c});
+                return false;
+            case 10:
+                emit_call(reinterpret_cast<void const*>(&helper_output), {c});
+                return false;
+            case 11: emit_exit(exit_input, pc); return true;
+            case 12: {
+                // Jumps within array 0 stay in translated code
+                code.test(host(b), host(b));
+                size_t load = code.jcc(cond_ne);
+                code.mov(rax, host(c));
+                emit_dispatch();
+                code.patch(load, code.here());
+                emit_exit(exit_load, pc);
+                return true;
+            }
+            case 13:
+                code.mov(host(i.get_special()), i.get_special_value());
+                return false;
+            default: return false;
+        }
+    }
+
+    void flush() {
+        code.rewind(preamble_size);
+        entries.assign(m.arrays[0].size(), nullptr);
+        coverage.assign(m.arrays[0].size(), 0);
+        blocks.clear();
+        ctx.entries = entries.data();
+        ctx.coverage = coverage.data();
+        ctx.entry_count = uint32_t(entries.size());
+    }
+
+    void invalidate(uint offset) {
+        auto covers = [=](block const& b) {
+            return b.start <= offset && offset <= b.end;
+        };
+        for (block const& b : blocks) {
+            if (covers(b)) {
+                entries[b.start] = nullptr;
+                for (uint pc = b.start; pc <= b.end; pc++) {
+                    coverage[pc]--;
+                }
+            }
+        }
+        blocks.erase(
+            std::remove_if(blocks.begin(), blocks.end(), covers),
+            blocks.end());
+    }
+
+    // Returns the translation of the block starting at pc
+    void const* compile(uint pc) {
+        if (code.remaining() < 2 * max_instruction_bytes) {
+            flush();
+        }
+        uint program_size = uint(m.arrays[0].size());
+        void* start = code.here();
+        uint end = pc;
+        for (;; end++) {
+            if (end >= program_size) {
+                // Running off the end of the program stops the machine
+                emit_exit(exit_halt, end);
+                break;
+            }
+            // Blocks also end early when the code buffer is nearly full, so
+            // that the next compile() starts over with an empty one
+            if (end - pc == max_block_length ||
+                code.remaining() < 2 * max_instruction_bytes) {
+                emit_dispatch(end);
+                break;
+            }
+            if (emit_instruction(end, m.get_instruction(end))) {
+                break;
+            }
+        }
+        if (pc < program_size) {
+            end = std::min(end, program_size - 1);
+            entries[pc] = start;
+            for (uint i = pc; i <= end; i++) {
+                coverage[i]++;
+            }
+            blocks.push_back(block {pc, end});
+        }
+        return start;
+    }
+
+   public:
+    jit(machine& m, size_t code_capacity = size_t(64) << 20)
+      : m(m)
+      , code(code_capacity) {
+        ctx.registers = m.registers.data();
+        ctx.table = m.arrays.data();
+        ctx.self = this;
+        inline_arrays = probe_data_offset(data_offset);
+        emit_preamble();
+        flush();
+    }
+
+    /**
+     * @brief Runs the machine until it halts, starting from its program
+     * counter
+     *
+     */
+    void run() {
+        if (m.halted) {
+            return;
+        }
+        // Translated code writes to array 0 without updating the machine's
+        // predecoded copy of it
+        m.decoded_stale = true;
+        uint pc = m.program_counter;
+        for (;;) {
+            void const* target = pc < entries.size() && entries[pc]
+                                   ? entries[pc]
+                                   : compile(pc);
+            enter(&ctx, target);
+            pc = ctx.next_pc;
+            switch (ctx.reason) {
+                case exit_halt:
+                    m.halted = true;
+                    m.io.flush();
+                    return;
+                case exit_dispatch: break;
+                case exit_input: {
+                    instruction i = m.get_instruction(pc);
+                    m.set_C_register(i, m.read_char());
+                    pc++;
+                    break;
+                }
+                case exit_load: {
+                    instruction i = m.get_instruction(pc);
+                    m.load_program(m.get_B_register(i));
+                    pc = m.get_C_register(i);
+                    flush();
+                    break;
+                }
+                case exit_allocate: {
+                    instruction i = m.get_instruction(pc);
+                    m.program_counter = pc;
+                    m.set_B_register(i, m.allocate(m.get_C_register(i)));
+                    ctx.table = m.arrays.data();
+                    pc++;
+                    break;
+                }
+            }
+        }
+    }
+};
+#endif
+
+/**
+ * @brief Runs the machine with the jit if it's supported on this platform,
+ * falling back to the interpreter otherwise
+ *
+ */
+inline void run_jit(machine& m) {
+#if COMPILER_HAS_JIT
+    jit(m).run();
+#else
+    m.run_loop_superinstructions();
+#endif
+}
+} // namespace compiler
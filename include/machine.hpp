@@ -1,14 +1,88 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <array_space.hpp>
 #include <cstdio>
 #include <definitions.hpp>
 #include <ins.hpp>
+#include <io.hpp>
+#include <utility>
 #include <vector>
+#include <word_array.hpp>
+
+// Superinstructions are generated at build time from the profiles in
+// profiles/ (see tools/gen-superinstructions.cpp). Without them, every
+// instruction is dispatched on its own
+#if __has_include(<superinstructions.hpp>)
+#include <superinstructions.hpp>
+#else
+namespace compiler {
+constexpr size_t superinstruction_max_length = 1;
+constexpr size_t superinstruction_count = 0;
+constexpr uint16_t superinstruction_trie[1][16] {};
+constexpr uint8_t superinstruction_accept[1] {};
+} // namespace compiler
+#define SUPERINSTRUCTION_CASES
+#endif
+
+// Computed goto (&&label) is a GCC extension that's also supported by clang
+#if defined(__GNUC__)
+#define COMPILER_HAS_COMPUTED_GOTO 1
+#else
+#define COMPILER_HAS_COMPUTED_GOTO 0
+#endif
+
+// The tail-call engine needs every handler to jump to the next one instead
+// of calling it. clang can guarantee this with musttail. Otherwise we rely on
+// the optimizer turning the calls into jumps, which GCC only does with
+// -foptimize-sibling-calls (part of -O2, but not -O1 or -Og). The build
+// defines COMPILER_SIBLING_CALLS when it passes that flag. The sanitizers
+// keep GCC from turning calls into jumps even then, so the engine is left out
+// when they're on.
+#if defined(__has_cpp_attribute)
+#if __has_cpp_attribute(clang::musttail)
+#define COMPILER_MUSTTAIL [[clang::musttail]]
+#endif
+#endif
+#if defined(COMPILER_MUSTTAIL)
+#define COMPILER_HAS_TAIL_CALLS 1
+#elif defined(__OPTIMIZE__) && defined(COMPILER_SIBLING_CALLS) \
+    && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+#define COMPILER_MUSTTAIL
+#define COMPILER_HAS_TAIL_CALLS 1
+#else
+#define COMPILER_MUSTTAIL
+#define COMPILER_HAS_TAIL_CALLS 0
+#endif
+// The specialized engine has thousands of handlers, which take the compiler
+// minutes to build in every file that includes this one, so it's only built
+// when COMPILER_SPECIALIZED_ENGINE is defined (see the SPECIALIZED_ENGINE
+// option in CMakeLists.txt)
+#if COMPILER_HAS_TAIL_CALLS && defined(COMPILER_SPECIALIZED_ENGINE)
+#define COMPILER_HAS_SPECIALIZED 1
+#else
+#define COMPILER_HAS_SPECIALIZED 0
+#endif
+
+// Called by run_loop() for each instruction it executes, with the position of
+// the instruction in array 0. Tools that need to observe execution (such as
+// collect-ngrams) define this before including machine.hpp
+#ifndef COMPILER_ON_INSTRUCTION
+#define COMPILER_ON_INSTRUCTION(PC, INS)
+#endif
+// Called by the interpreters for each op 12, after array INDEX has been
+// loaded into array 0 (PROGRAM). INDEX is 0 when the op is only a jump
+#ifndef COMPILER_ON_LOAD_PROGRAM
+#define COMPILER_ON_LOAD_PROGRAM(INDEX, PROGRAM)
+#endif
+// Called by the interpreters for each op 8, with the number of words
+// requested
+#ifndef COMPILER_ON_ALLOCATE
+#define COMPILER_ON_ALLOCATE(SIZE)
+#endif
 
 namespace compiler {
-using word_array = std::vector<uint>;
-using array_space = std::vector<word_array>;
 
 struct new_state {
     uint counter = 0;
@@ -19,13 +93,147 @@ struct new_state {
 
 constexpr new_state halt_state = new_state {0, true};
 
+/**
+ * @brief Why machine::run_for() returned
+ *
+ */
+enum class run_status {
+    halted,
+    // The budget ran out first
+    out_of_budget,
+    // The next instruction is an op 11, and the console has no input ready.
+    // It runs once there is some
+    needs_input,
+    // Like out_of_budget, but the machine wrote output, which has been
+    // passed on to the sink
+    output_ready,
+};
+
 
 class machine {
+    struct decoded_instruction;
+    using tail_handler = void (*)(machine&, decoded_instruction const*, uint);
+    // Handler used by the specialized engine, which runs array 0 directly
+    using word_handler = void (*)(machine&, uint const*, uint);
+
+    /**
+     * @brief An instruction from array 0 with its fields already extracted.
+     * Registers are given as byte offsets into the register file.
+     *
+     */
+    struct decoded_instruction {
+        // Handler used by the tail-call engine
+        tail_handler handler = nullptr;
+        // The value loaded by op 13
+        uint value = 0;
+        uint8_t op = 0;
+        // For op 13, a holds the special register
+        uint8_t a = 0;
+        uint8_t b = 0;
+        uint8_t c = 0;
+
+        uint get_special_value() const { return value; }
+    };
+
     array_space arrays;
-    std::vector<uint> deallocated;
     std::array<uint, 8> registers {};
+    console io = console::standard();
+    // Predecoded copy of array 0, kept in sync by load_program() and store()
+    // once an engine that uses it has run
+    std::vector<decoded_instruction> decoded;
+    // The superinstruction that starts at each position in array 0, or the
+    // opcode if there isn't one
+    std::vector<uint8_t> sequences;
+    // Set by engines that write to array 0 without going through store(), and
+    // until an engine that uses the predecoded program first runs, so that
+    // machines only run by the switch engine never build it
+    bool decoded_stale = false;
+    // Where the engines start executing. This is only updated when an engine
+    // stops before the machine halts
+    uint program_counter = 0;
+    bool halted = false;
+    // Set by run_switch<true>() when it stops at an op 11 that would wait
+    // for input, and when it runs an op 10
+    bool waiting_for_input = false;
+    bool wrote_output = false;
 
-    void print_char(char c) { putchar(c); }
+    friend class jit;
+    friend class ir_tier;
+    friend class aot_runtime;
+    friend class snapshot;
+
+    static decoded_instruction decode(instruction i) {
+        uint op = i.get_OP();
+        uint a = op == 13 ? i.get_special() : i.get_A();
+        return decoded_instruction {
+            tail_handlers()[op],
+            i.get_special_value(),
+            uint8_t(op),
+            uint8_t(a * sizeof(uint)),
+            uint8_t(i.get_B() * sizeof(uint)),
+            uint8_t(i.get_C() * sizeof(uint))};
+    }
+    // Finds the longest superinstruction starting at the given position
+    uint8_t match_sequence(size_t pc) const {
+        uint8_t id = decoded[pc].op;
+        // The padding word at the end isn't part of the program
+        size_t available = std::min(
+            decoded.size() - 1 - pc,
+            superinstruction_max_length);
+        uint node = 0;
+        for (size_t i = 0; i < available; i++) {
+            node = superinstruction_trie[node][decoded[pc + i].op];
+            if (node == 0) {
+                break;
+            }
+            if (superinstruction_accept[node] != 0) {
+                id = superinstruction_accept[node];
+            }
+        }
+        return id;
+    }
+    void predecode() {
+        // Include the padding word after the end of the program
+        uint const* program = arrays[0].data();
+        decoded.resize(arrays[0].size() + 1);
+        for (size_t i = 0; i < decoded.size(); i++) {
+            decoded[i] = decode(instruction {program[i]});
+        }
+        sequences.resize(decoded.size());
+        for (size_t i = 0; i < sequences.size(); i++) {
+            sequences[i] = match_sequence(i);
+        }
+        decoded_stale = false;
+    }
+    void refresh_decoded() {
+        if (decoded_stale) {
+            predecode();
+        }
+    }
+    uint& register_at(uint8_t offset) {
+        return *reinterpret_cast<uint*>(
+            reinterpret_cast<char*>(registers.data()) + offset);
+    }
+    uint register_at(uint8_t offset) const {
+        return *reinterpret_cast<uint const*>(
+            reinterpret_cast<char const*>(registers.data()) + offset);
+    }
+    // Returns the start of array 0, in the form used by the engine
+    uint const* program_start(uint const*) const { return arrays[0].data(); }
+    decoded_instruction const* program_start(
+        decoded_instruction const*) const {
+        return decoded.data();
+    }
+
+    void print_char(char c) { io.put(c); }
+    uint read_char() {
+        int ch = io.get();
+        return ch == EOF ? ~0u : uint(ch) & 0xffu;
+    }
+
+    machine(array_space arrays, console io)
+      : arrays(std::move(arrays))
+      , io(std::move(io)) {}
 
    public:
     machine() = default;
@@ -36,8 +244,30 @@ class machine {
      */
     machine(word_array program) {
         arrays.push_back(std::move(program));
-        // Ensure there's an extra value padding the end
-        arrays[0].push_back(0);
+        decoded_stale = true;
+    }
+
+    /**
+     * @brief Makes a machine in the same state as this one, which carries on
+     * from where this one is. The two share all of their arrays until one of
+     * them writes to an array, which copies just that array, so cloning takes
+     * time and memory in proportion to the number of arrays rather than
+     * their size. The clone only builds a predecoded copy of the program if
+     * it runs on an engine that uses one.
+     *
+     * Arrays identified by their addresses can't be shared, so machines
+     * using pointer identifiers can't be cloned, but clones can start using
+     * them
+     *
+     * @param new_io the console of the clone
+     */
+    machine clone(console new_io) const {
+        machine copy(arrays, std::move(new_io));
+        copy.registers = registers;
+        copy.program_counter = program_counter;
+        copy.halted = halted;
+        copy.decoded_stale = true;
+        return copy;
     }
 
     /**
@@ -48,23 +278,103 @@ class machine {
      * - Otherwise, we allocate a new array at the end of the list of arrays
      * - Either way, we return the index.
      *
+     * The deallocated spaces are tracked by the array_space itself.
+     *
      * @param size The size of the new array to allocate
      * @return uint The index of the newly allocated array
      */
-    uint allocate(uint size) {
-        if (deallocated.empty()) {
-            arrays.push_back(word_array(size, 0));
-            return arrays.size() - 1;
-        } else {
-            uint index = deallocated.back();
-            deallocated.pop_back();
-            arrays[index].resize(size, 0);
-            return index;
+    uint allocate(uint size) { return arrays.allocate(size); }
+    void deallocate(uint index) { arrays.deallocate(index); }
+    /**
+     * @brief Replaces the console used for input and output. By default, a
+     * machine has a buffered console on standard input and output
+     *
+     */
+    void set_console(console new_io) { io = std::move(new_io); }
+    console& get_console() { return io; }
+    bool is_halted() const { return halted; }
+    /**
+     * @brief Limits the memory taken up by the arrays of this machine,
+     * counting every word of each allocated array, along with its header
+     * and its entry in the table of arrays. An op 8 that would go over the
+     * limit throws memory_limit_exceeded out of whichever engine is running
+     * the machine
+     *
+     */
+    void set_memory_limit(size_t bytes) {
+        arrays.set_word_limit(bytes / sizeof(uint));
+    }
+    /**
+     * @brief How much memory the arrays take up, along with what the arena
+     * of the calling thread holds (see memory_usage)
+     *
+     */
+    memory_usage get_memory_usage() const {
+        memory_usage result = arrays.usage();
+        arena::stats pool = arena::local().get_stats();
+        result.reserved_bytes = pool.reserved_bytes;
+        result.cached_bytes = pool.cached_bytes;
+        return result;
+    }
+    /**
+     * @brief Gives back the memory held by freed arrays: the free entries at
+     * the end of the table, and the pages of the free blocks in the arena of
+     * the calling thread. Both also happen on their own once enough has been
+     * freed
+     *
+     */
+    void trim_memory() {
+        arrays.trim();
+        arena::local().trim();
+    }
+    /**
+     * @brief Identifies arrays allocated from now on by their addresses,
+     * where possible, so loads and stores don't need to look them up (see
+     * array_space)
+     *
+     * @return true if pointer identifiers are in use, or false if they
+     * aren't supported on this platform
+     */
+    bool enable_pointer_ids() { return arrays.enable_pointer_ids(); }
+    /**
+     * @brief Replaces array 0 with a duplicate of the given array. The
+     * duplicate shares storage with the original until either one is written
+     * to, so this doesn't copy any words
+     *
+     * @param index the identifier of the array to load. Loading array 0, or
+     * an array that array 0 is still shared with, is a no-op
+     */
+    void load_program(uint index) {
+        if (!arrays[0].shares_storage_with(arrays[index])) {
+            arrays.replace(0, arrays[index]);
+            if (!decoded_stale) {
+                predecode();
+            }
         }
     }
-    void deallocate(uint index) {
-        arrays[index].clear();
-        deallocated.push_back(index);
+    uint load(uint array_index, uint offset) const {
+        return arrays.words(array_index)[offset];
+    }
+    /**
+     * @brief Stores a value into an array. Stores into array 0 also update
+     * the predecoded copy of the program, unless it's going to be rebuilt
+     *
+     */
+    void store(uint array_index, uint offset, uint value) {
+        arrays.store(array_index, offset, value);
+        if (array_index == 0 && !decoded_stale) {
+            uint8_t old_op = decoded[offset].op;
+            decoded[offset] = decode(instruction {value});
+            // Superinstructions only depend on opcodes
+            if (decoded[offset].op != old_op) {
+                size_t first = offset + 1 >= superinstruction_max_length
+                                 ? offset + 1 - superinstruction_max_length
+                                 : 0;
+                for (size_t pc = first; pc <= offset; pc++) {
+                    sequences[pc] = match_sequence(pc);
+                }
+            }
+        }
     }
     uint get_A_register(instruction i) const { return registers[i.get_A()]; }
     uint get_B_register(instruction i) const { return registers[i.get_B()]; }
@@ -82,20 +392,108 @@ class machine {
     void set_special_register(instruction i, uint value) {
         registers[i.get_special()] = value;
     }
+    uint get_A_register(decoded_instruction const& i) const {
+        return register_at(i.a);
+    }
+    uint get_B_register(decoded_instruction const& i) const {
+        return register_at(i.b);
+    }
+    uint get_C_register(decoded_instruction const& i) const {
+        return register_at(i.c);
+    }
+    void set_A_register(decoded_instruction const& i, uint value) {
+        register_at(i.a) = value;
+    }
+    void set_B_register(decoded_instruction const& i, uint value) {
+        register_at(i.b) = value;
+    }
+    void set_C_register(decoded_instruction const& i, uint value) {
+        register_at(i.c) = value;
+    }
+    void set_special_register(decoded_instruction const& i, uint value) {
+        register_at(i.a) = value;
+    }
     instruction get_instruction(uint counter) {
         return instruction {arrays[0][counter]};
     }
 
     void run_loop() {
-        uint counter = 0;
+        uint64_t unlimited = 0;
+        run_switch<false>(unlimited);
+    }
+    /**
+     * @brief Like run_loop(), but stops after the given number of
+     * instructions if the machine hasn't halted by then. Running the machine
+     * again with any engine picks up where it stopped
+     *
+     * @return uint64_t the number of instructions executed, including the
+     * halt instruction if the machine halted
+     */
+    uint64_t run_loop_for(uint64_t count) {
+        uint64_t budget = count;
+        run_switch<true>(budget);
+        return count - budget;
+    }
+    /**
+     * @brief Runs at most budget instructions, and returns why it stopped.
+     * Nothing waits for input: if the console has none ready when an op 11
+     * comes up, the machine stops before it (see queued_source). Any output
+     * written has been passed to the sink by the time this returns, so one
+     * thread can take turns running many machines. The position is kept in
+     * the machine between calls, and any engine can carry on from it
+     *
+     */
+    run_status run_for(uint64_t budget) {
+        waiting_for_input = false;
+        wrote_output = false;
+        run_switch<true>(budget);
+        if (halted) {
+            return run_status::halted;
+        }
+        if (wrote_output) {
+            io.flush();
+        }
+        if (waiting_for_input) {
+            return run_status::needs_input;
+        }
+        return wrote_output ? run_status::output_ready
+                            : run_status::out_of_budget;
+    }
+    // Runs a single instruction
+    run_status step() { return run_for(1); }
+
+   private:
+    // When limited, budget is the number of instructions left to execute,
+    // and it's counted down as they are
+    template <bool limited>
+    void run_switch(uint64_t& budget) {
+        if (halted) {
+            return;
+        }
+        uint counter = program_counter;
         uint const* instruction_ptr = arrays[0].data();
         for (;;) {
+            if constexpr (limited) {
+                if (budget == 0) {
+                    program_counter = counter;
+                    return;
+                }
+                budget--;
+            }
             instruction i1 = instruction {instruction_ptr[counter++]};
+            COMPILER_ON_INSTRUCTION(counter - 1, i1);
             uint opcode = i1.get_OP();
             switch (opcode) {
                 case 0: OPCODE_0(i1); break;
                 case 1: OPCODE_1(i1); break;
-                case 2: OPCODE_2(i1); break;
+                case 2:
+                    OPCODE_2(i1);
+                    // A store into array 0 while it shares its storage with
+                    // a loaded array gives it a copy of its own, and so does
+                    // a store into an array with a pointer identifier that
+                    // array 0 is sharing storage with
+                    instruction_ptr = program_start(instruction_ptr);
+                    break;
                 case 3: OPCODE_3(i1); break;
                 case 4: OPCODE_4(i1); break;
                 case 5: OPCODE_5(i1); break;
@@ -103,1048 +501,345 @@ class machine {
                 case 7: OPCODE_7(i1); break;
                 case 8: OPCODE_8(i1); break;
                 case 9: OPCODE_9(i1); break;
-                case 10: OPCODE_10(i1); break;
-                case 11: OPCODE_11(i1); break;
+                case 10:
+                    OPCODE_10(i1);
+                    if constexpr (limited) {
+                        wrote_output = true;
+                    }
+                    break;
+                case 11:
+                    if constexpr (limited) {
+                        if (!io.input_ready()) {
+                            // Not executed, so it isn't counted
+                            program_counter = counter - 1;
+                            waiting_for_input = true;
+                            budget++;
+                            return;
+                        }
+                    }
+                    OPCODE_11(i1);
+                    break;
                 case 12: OPCODE_12(i1); break;
                 case 13: OPCODE_13(i1); break;
             }
         }
     }
-    void run_loop_vectorized() {
-        uint counter = 0;
-        uint const* instruction_ptr = arrays[0].data();
+
+   public:
+    /**
+     * @brief Interpreter over the predecoded program that dispatches whole
+     * sequences of instructions at once. The sequences are the
+     * superinstructions generated from profiles of real programs; anything
+     * else is dispatched one instruction at a time
+     *
+     */
+    void run_loop_superinstructions() {
+        if (halted) {
+            return;
+        }
+        refresh_decoded();
+        uint counter = program_counter;
+        decoded_instruction const* instruction_ptr = decoded.data();
+        uint8_t const* sequence_ptr = sequences.data();
         for (;;) {
-            instruction i1 = instruction {instruction_ptr[counter]};
-            instruction i2 = instruction {instruction_ptr[counter + 1]};
-            counter += 2;
-            uint opcode = i1.get_OP() * 16 + i2.get_OP();
-            switch (opcode) {
-                case 0:
-                    OPCODE_0(i1);
-                    OPCODE_0(i2);
-                    break;
-                case 1:
-                    OPCODE_0(i1);
-                    OPCODE_1(i2);
-                    break;
-                case 2:
-                    OPCODE_0(i1);
-                    OPCODE_2(i2);
-                    break;
-                case 3:
-                    OPCODE_0(i1);
-                    OPCODE_3(i2);
-                    break;
-                case 4:
-                    OPCODE_0(i1);
-                    OPCODE_4(i2);
-                    break;
-                case 5:
-                    OPCODE_0(i1);
-                    OPCODE_5(i2);
-                    break;
-                case 6:
-                    OPCODE_0(i1);
-                    OPCODE_6(i2);
-                    break;
-                case 7:
-                    OPCODE_0(i1);
-                    OPCODE_7(i2);
-                    break;
-                case 8:
-                    OPCODE_0(i1);
-                    OPCODE_8(i2);
-                    break;
-                case 9:
-                    OPCODE_0(i1);
-                    OPCODE_9(i2);
-                    break;
-                case 10:
-                    OPCODE_0(i1);
-                    OPCODE_10(i2);
-                    break;
-                case 11:
-                    OPCODE_0(i1);
-                    OPCODE_11(i2);
-                    break;
+            decoded_instruction const* i1 = instruction_ptr + counter;
+            switch (sequence_ptr[counter]) {
+                case 0: counter++; OPCODE_0(i1[0]); break;
+                case 1: counter++; OPCODE_1(i1[0]); break;
+                case 2: counter++; OPCODE_2(i1[0]); break;
+                case 3: counter++; OPCODE_3(i1[0]); break;
+                case 4: counter++; OPCODE_4(i1[0]); break;
+                case 5: counter++; OPCODE_5(i1[0]); break;
+                case 6: counter++; OPCODE_6(i1[0]); break;
+                case 7: OPCODE_7(i1[0]);
+                case 8: counter++; OPCODE_8(i1[0]); break;
+                case 9: counter++; OPCODE_9(i1[0]); break;
+                case 10: counter++; OPCODE_10(i1[0]); break;
+                case 11: counter++; OPCODE_11(i1[0]); break;
                 case 12:
-                    OPCODE_0(i1);
-                    OPCODE_12(i2);
-                    break;
-                case 13:
-                    OPCODE_0(i1);
-                    OPCODE_13(i2);
+                    LOAD_PROGRAM(i1[0]);
+                    sequence_ptr = sequences.data();
                     break;
+                case 13: counter++; OPCODE_13(i1[0]); break;
                 case 14:
-                    OPCODE_0(i1);
-                    OPCODE_14(i2);
-                    break;
-                case 15:
-                    OPCODE_0(i1);
-                    OPCODE_15(i2);
-                    break;
-                case 16:
-                    OPCODE_1(i1);
-                    OPCODE_0(i2);
-                    break;
-                case 17:
-                    OPCODE_1(i1);
-                    OPCODE_1(i2);
-                    break;
-                case 18:
-                    OPCODE_1(i1);
-                    OPCODE_2(i2);
-                    break;
-                case 19:
-                    OPCODE_1(i1);
-                    OPCODE_3(i2);
-                    break;
-                case 20:
-                    OPCODE_1(i1);
-                    OPCODE_4(i2);
-                    break;
-                case 21:
-                    OPCODE_1(i1);
-                    OPCODE_5(i2);
-                    break;
-                case 22:
-                    OPCODE_1(i1);
-                    OPCODE_6(i2);
-                    break;
-                case 23:
-                    OPCODE_1(i1);
-                    OPCODE_7(i2);
-                    break;
-                case 24:
-                    OPCODE_1(i1);
-                    OPCODE_8(i2);
-                    break;
-                case 25:
-                    OPCODE_1(i1);
-                    OPCODE_9(i2);
-                    break;
-                case 26:
-                    OPCODE_1(i1);
-                    OPCODE_10(i2);
-                    break;
-                case 27:
-                    OPCODE_1(i1);
-                    OPCODE_11(i2);
-                    break;
-                case 28:
-                    OPCODE_1(i1);
-                    OPCODE_12(i2);
-                    break;
-                case 29:
-                    OPCODE_1(i1);
-                    OPCODE_13(i2);
-                    break;
-                case 30:
-                    OPCODE_1(i1);
-                    OPCODE_14(i2);
-                    break;
-                case 31:
-                    OPCODE_1(i1);
-                    OPCODE_15(i2);
-                    break;
-                case 32:
-                    OPCODE_2(i1);
-                    OPCODE_0(i2);
-                    break;
-                case 33:
-                    OPCODE_2(i1);
-                    OPCODE_1(i2);
-                    break;
-                case 34:
-                    OPCODE_2(i1);
-                    OPCODE_2(i2);
-                    break;
-                case 35:
-                    OPCODE_2(i1);
-                    OPCODE_3(i2);
-                    break;
-                case 36:
-                    OPCODE_2(i1);
-                    OPCODE_4(i2);
-                    break;
-                case 37:
-                    OPCODE_2(i1);
-                    OPCODE_5(i2);
-                    break;
-                case 38:
-                    OPCODE_2(i1);
-                    OPCODE_6(i2);
-                    break;
-                case 39:
-                    OPCODE_2(i1);
-                    OPCODE_7(i2);
-                    break;
-                case 40:
-                    OPCODE_2(i1);
-                    OPCODE_8(i2);
-                    break;
-                case 41:
-                    OPCODE_2(i1);
-                    OPCODE_9(i2);
-                    break;
-                case 42:
-                    OPCODE_2(i1);
-                    OPCODE_10(i2);
-                    break;
-                case 43:
-                    OPCODE_2(i1);
-                    OPCODE_11(i2);
-                    break;
-                case 44:
-                    OPCODE_2(i1);
-                    OPCODE_12(i2);
-                    break;
-                case 45:
-                    OPCODE_2(i1);
-                    OPCODE_13(i2);
-                    break;
-                case 46:
-                    OPCODE_2(i1);
-                    OPCODE_14(i2);
-                    break;
-                case 47:
-                    OPCODE_2(i1);
-                    OPCODE_15(i2);
-                    break;
-                case 48:
-                    OPCODE_3(i1);
-                    OPCODE_0(i2);
-                    break;
-                case 49:
-                    OPCODE_3(i1);
-                    OPCODE_1(i2);
-                    break;
-                case 50:
-                    OPCODE_3(i1);
-                    OPCODE_2(i2);
-                    break;
-                case 51:
-                    OPCODE_3(i1);
-                    OPCODE_3(i2);
-                    break;
-                case 52:
-                    OPCODE_3(i1);
-                    OPCODE_4(i2);
-                    break;
-                case 53:
-                    OPCODE_3(i1);
-                    OPCODE_5(i2);
-                    break;
-                case 54:
-                    OPCODE_3(i1);
-                    OPCODE_6(i2);
-                    break;
-                case 55:
-                    OPCODE_3(i1);
-                    OPCODE_7(i2);
-                    break;
-                case 56:
-                    OPCODE_3(i1);
-                    OPCODE_8(i2);
-                    break;
-                case 57:
-                    OPCODE_3(i1);
-                    OPCODE_9(i2);
-                    break;
-                case 58:
-                    OPCODE_3(i1);
-                    OPCODE_10(i2);
-                    break;
-                case 59:
-                    OPCODE_3(i1);
-                    OPCODE_11(i2);
-                    break;
-                case 60:
-                    OPCODE_3(i1);
-                    OPCODE_12(i2);
-                    break;
-                case 61:
-                    OPCODE_3(i1);
-                    OPCODE_13(i2);
-                    break;
-                case 62:
-                    OPCODE_3(i1);
-                    OPCODE_14(i2);
-                    break;
-                case 63:
-                    OPCODE_3(i1);
-                    OPCODE_15(i2);
-                    break;
-                case 64:
-                    OPCODE_4(i1);
-                    OPCODE_0(i2);
-                    break;
-                case 65:
-                    OPCODE_4(i1);
-                    OPCODE_1(i2);
-                    break;
-                case 66:
-                    OPCODE_4(i1);
-                    OPCODE_2(i2);
-                    break;
-                case 67:
-                    OPCODE_4(i1);
-                    OPCODE_3(i2);
-                    break;
-                case 68:
-                    OPCODE_4(i1);
-                    OPCODE_4(i2);
-                    break;
-                case 69:
-                    OPCODE_4(i1);
-                    OPCODE_5(i2);
-                    break;
-                case 70:
-                    OPCODE_4(i1);
-                    OPCODE_6(i2);
-                    break;
-                case 71:
-                    OPCODE_4(i1);
-                    OPCODE_7(i2);
-                    break;
-                case 72:
-                    OPCODE_4(i1);
-                    OPCODE_8(i2);
-                    break;
-                case 73:
-                    OPCODE_4(i1);
-                    OPCODE_9(i2);
-                    break;
-                case 74:
-                    OPCODE_4(i1);
-                    OPCODE_10(i2);
-                    break;
-                case 75:
-                    OPCODE_4(i1);
-                    OPCODE_11(i2);
-                    break;
-                case 76:
-                    OPCODE_4(i1);
-                    OPCODE_12(i2);
-                    break;
-                case 77:
-                    OPCODE_4(i1);
-                    OPCODE_13(i2);
-                    break;
-                case 78:
-                    OPCODE_4(i1);
-                    OPCODE_14(i2);
-                    break;
-                case 79:
-                    OPCODE_4(i1);
-                    OPCODE_15(i2);
-                    break;
-                case 80:
-                    OPCODE_5(i1);
-                    OPCODE_0(i2);
-                    break;
-                case 81:
-                    OPCODE_5(i1);
-                    OPCODE_1(i2);
-                    break;
-                case 82:
-                    OPCODE_5(i1);
-                    OPCODE_2(i2);
-                    break;
-                case 83:
-                    OPCODE_5(i1);
-                    OPCODE_3(i2);
-                    break;
-                case 84:
-                    OPCODE_5(i1);
-                    OPCODE_4(i2);
-                    break;
-                case 85:
-                    OPCODE_5(i1);
-                    OPCODE_5(i2);
-                    break;
-                case 86:
-                    OPCODE_5(i1);
-                    OPCODE_6(i2);
-                    break;
-                case 87:
-                    OPCODE_5(i1);
-                    OPCODE_7(i2);
-                    break;
-                case 88:
-                    OPCODE_5(i1);
-                    OPCODE_8(i2);
-                    break;
-                case 89:
-                    OPCODE_5(i1);
-                    OPCODE_9(i2);
-                    break;
-                case 90:
-                    OPCODE_5(i1);
-                    OPCODE_10(i2);
-                    break;
-                case 91:
-                    OPCODE_5(i1);
-                    OPCODE_11(i2);
-                    break;
-                case 92:
-                    OPCODE_5(i1);
-                    OPCODE_12(i2);
-                    break;
-                case 93:
-                    OPCODE_5(i1);
-                    OPCODE_13(i2);
-                    break;
-                case 94:
-                    OPCODE_5(i1);
-                    OPCODE_14(i2);
-                    break;
-                case 95:
-                    OPCODE_5(i1);
-                    OPCODE_15(i2);
-                    break;
-                case 96:
-                    OPCODE_6(i1);
-                    OPCODE_0(i2);
-                    break;
-                case 97:
-                    OPCODE_6(i1);
-                    OPCODE_1(i2);
-                    break;
-                case 98:
-                    OPCODE_6(i1);
-                    OPCODE_2(i2);
-                    break;
-                case 99:
-                    OPCODE_6(i1);
-                    OPCODE_3(i2);
-                    break;
-                case 100:
-                    OPCODE_6(i1);
-                    OPCODE_4(i2);
-                    break;
-                case 101:
-                    OPCODE_6(i1);
-                    OPCODE_5(i2);
-                    break;
-                case 102:
-                    OPCODE_6(i1);
-                    OPCODE_6(i2);
-                    break;
-                case 103:
-                    OPCODE_6(i1);
-                    OPCODE_7(i2);
-                    break;
-                case 104:
-                    OPCODE_6(i1);
-                    OPCODE_8(i2);
-                    break;
-                case 105:
-                    OPCODE_6(i1);
-                    OPCODE_9(i2);
-                    break;
-                case 106:
-                    OPCODE_6(i1);
-                    OPCODE_10(i2);
-                    break;
-                case 107:
-                    OPCODE_6(i1);
-                    OPCODE_11(i2);
-                    break;
-                case 108:
-                    OPCODE_6(i1);
-                    OPCODE_12(i2);
-                    break;
-                case 109:
-                    OPCODE_6(i1);
-                    OPCODE_13(i2);
-                    break;
-                case 110:
-                    OPCODE_6(i1);
-                    OPCODE_14(i2);
-                    break;
-                case 111:
-                    OPCODE_6(i1);
-                    OPCODE_15(i2);
-                    break;
-                case 112:
-                    OPCODE_7(i1);
-                    OPCODE_0(i2);
-                    break;
-                case 113:
-                    OPCODE_7(i1);
-                    OPCODE_1(i2);
-                    break;
-                case 114:
-                    OPCODE_7(i1);
-                    OPCODE_2(i2);
-                    break;
-                case 115:
-                    OPCODE_7(i1);
-                    OPCODE_3(i2);
-                    break;
-                case 116:
-                    OPCODE_7(i1);
-                    OPCODE_4(i2);
-                    break;
-                case 117:
-                    OPCODE_7(i1);
-                    OPCODE_5(i2);
-                    break;
-                case 118:
-                    OPCODE_7(i1);
-                    OPCODE_6(i2);
-                    break;
-                case 119:
-                    OPCODE_7(i1);
-                    OPCODE_7(i2);
-                    break;
-                case 120:
-                    OPCODE_7(i1);
-                    OPCODE_8(i2);
-                    break;
-                case 121:
-                    OPCODE_7(i1);
-                    OPCODE_9(i2);
-                    break;
-                case 122:
-                    OPCODE_7(i1);
-                    OPCODE_10(i2);
-                    break;
-                case 123:
-                    OPCODE_7(i1);
-                    OPCODE_11(i2);
-                    break;
-                case 124:
-                    OPCODE_7(i1);
-                    OPCODE_12(i2);
-                    break;
-                case 125:
-                    OPCODE_7(i1);
-                    OPCODE_13(i2);
-                    break;
-                case 126:
-                    OPCODE_7(i1);
-                    OPCODE_14(i2);
-                    break;
-                case 127:
-                    OPCODE_7(i1);
-                    OPCODE_15(i2);
-                    break;
-                case 128:
-                    OPCODE_8(i1);
-                    OPCODE_0(i2);
-                    break;
-                case 129:
-                    OPCODE_8(i1);
-                    OPCODE_1(i2);
-                    break;
-                case 130:
-                    OPCODE_8(i1);
-                    OPCODE_2(i2);
-                    break;
-                case 131:
-                    OPCODE_8(i1);
-                    OPCODE_3(i2);
-                    break;
-                case 132:
-                    OPCODE_8(i1);
-                    OPCODE_4(i2);
-                    break;
-                case 133:
-                    OPCODE_8(i1);
-                    OPCODE_5(i2);
-                    break;
-                case 134:
-                    OPCODE_8(i1);
-                    OPCODE_6(i2);
-                    break;
-                case 135:
-                    OPCODE_8(i1);
-                    OPCODE_7(i2);
-                    break;
-                case 136:
-                    OPCODE_8(i1);
-                    OPCODE_8(i2);
-                    break;
-                case 137:
-                    OPCODE_8(i1);
-                    OPCODE_9(i2);
-                    break;
-                case 138:
-                    OPCODE_8(i1);
-                    OPCODE_10(i2);
-                    break;
-                case 139:
-                    OPCODE_8(i1);
-                    OPCODE_11(i2);
-                    break;
-                case 140:
-                    OPCODE_8(i1);
-                    OPCODE_12(i2);
-                    break;
-                case 141:
-                    OPCODE_8(i1);
-                    OPCODE_13(i2);
-                    break;
-                case 142:
-                    OPCODE_8(i1);
-                    OPCODE_14(i2);
-                    break;
-                case 143:
-                    OPCODE_8(i1);
-                    OPCODE_15(i2);
-                    break;
-                case 144:
-                    OPCODE_9(i1);
-                    OPCODE_0(i2);
-                    break;
-                case 145:
-                    OPCODE_9(i1);
-                    OPCODE_1(i2);
-                    break;
-                case 146:
-                    OPCODE_9(i1);
-                    OPCODE_2(i2);
-                    break;
-                case 147:
-                    OPCODE_9(i1);
-                    OPCODE_3(i2);
-                    break;
-                case 148:
-                    OPCODE_9(i1);
-                    OPCODE_4(i2);
-                    break;
-                case 149:
-                    OPCODE_9(i1);
-                    OPCODE_5(i2);
-                    break;
-                case 150:
-                    OPCODE_9(i1);
-                    OPCODE_6(i2);
-                    break;
-                case 151:
-                    OPCODE_9(i1);
-                    OPCODE_7(i2);
-                    break;
-                case 152:
-                    OPCODE_9(i1);
-                    OPCODE_8(i2);
-                    break;
-                case 153:
-                    OPCODE_9(i1);
-                    OPCODE_9(i2);
-                    break;
-                case 154:
-                    OPCODE_9(i1);
-                    OPCODE_10(i2);
-                    break;
-                case 155:
-                    OPCODE_9(i1);
-                    OPCODE_11(i2);
-                    break;
-                case 156:
-                    OPCODE_9(i1);
-                    OPCODE_12(i2);
-                    break;
-                case 157:
-                    OPCODE_9(i1);
-                    OPCODE_13(i2);
-                    break;
-                case 158:
-                    OPCODE_9(i1);
-                    OPCODE_14(i2);
-                    break;
-                case 159:
-                    OPCODE_9(i1);
-                    OPCODE_15(i2);
-                    break;
-                case 160:
-                    OPCODE_10(i1);
-                    OPCODE_0(i2);
-                    break;
-                case 161:
-                    OPCODE_10(i1);
-                    OPCODE_1(i2);
-                    break;
-                case 162:
-                    OPCODE_10(i1);
-                    OPCODE_2(i2);
-                    break;
-                case 163:
-                    OPCODE_10(i1);
-                    OPCODE_3(i2);
-                    break;
-                case 164:
-                    OPCODE_10(i1);
-                    OPCODE_4(i2);
-                    break;
-                case 165:
-                    OPCODE_10(i1);
-                    OPCODE_5(i2);
-                    break;
-                case 166:
-                    OPCODE_10(i1);
-                    OPCODE_6(i2);
-                    break;
-                case 167:
-                    OPCODE_10(i1);
-                    OPCODE_7(i2);
-                    break;
-                case 168:
-                    OPCODE_10(i1);
-                    OPCODE_8(i2);
-                    break;
-                case 169:
-                    OPCODE_10(i1);
-                    OPCODE_9(i2);
-                    break;
-                case 170:
-                    OPCODE_10(i1);
-                    OPCODE_10(i2);
-                    break;
-                case 171:
-                    OPCODE_10(i1);
-                    OPCODE_11(i2);
-                    break;
-                case 172:
-                    OPCODE_10(i1);
-                    OPCODE_12(i2);
-                    break;
-                case 173:
-                    OPCODE_10(i1);
-                    OPCODE_13(i2);
-                    break;
-                case 174:
-                    OPCODE_10(i1);
-                    OPCODE_14(i2);
-                    break;
-                case 175:
-                    OPCODE_10(i1);
-                    OPCODE_15(i2);
-                    break;
-                case 176:
-                    OPCODE_11(i1);
-                    OPCODE_0(i2);
-                    break;
-                case 177:
-                    OPCODE_11(i1);
-                    OPCODE_1(i2);
-                    break;
-                case 178:
-                    OPCODE_11(i1);
-                    OPCODE_2(i2);
-                    break;
-                case 179:
-                    OPCODE_11(i1);
-                    OPCODE_3(i2);
-                    break;
-                case 180:
-                    OPCODE_11(i1);
-                    OPCODE_4(i2);
-                    break;
-                case 181:
-                    OPCODE_11(i1);
-                    OPCODE_5(i2);
-                    break;
-                case 182:
-                    OPCODE_11(i1);
-                    OPCODE_6(i2);
-                    break;
-                case 183:
-                    OPCODE_11(i1);
-                    OPCODE_7(i2);
-                    break;
-                case 184:
-                    OPCODE_11(i1);
-                    OPCODE_8(i2);
-                    break;
-                case 185:
-                    OPCODE_11(i1);
-                    OPCODE_9(i2);
-                    break;
-                case 186:
-                    OPCODE_11(i1);
-                    OPCODE_10(i2);
-                    break;
-                case 187:
-                    OPCODE_11(i1);
-                    OPCODE_11(i2);
-                    break;
-                case 188:
-                    OPCODE_11(i1);
-                    OPCODE_12(i2);
-                    break;
-                case 189:
-                    OPCODE_11(i1);
-                    OPCODE_13(i2);
-                    break;
-                case 190:
-                    OPCODE_11(i1);
-                    OPCODE_14(i2);
-                    break;
-                case 191:
-                    OPCODE_11(i1);
-                    OPCODE_15(i2);
-                    break;
-                case 192:
-                    OPCODE_12(i1);
-                    OPCODE_0(i2);
-                    break;
-                case 193:
-                    OPCODE_12(i1);
-                    OPCODE_1(i2);
-                    break;
-                case 194:
-                    OPCODE_12(i1);
-                    OPCODE_2(i2);
-                    break;
-                case 195:
-                    OPCODE_12(i1);
-                    OPCODE_3(i2);
-                    break;
-                case 196:
-                    OPCODE_12(i1);
-                    OPCODE_4(i2);
-                    break;
-                case 197:
-                    OPCODE_12(i1);
-                    OPCODE_5(i2);
-                    break;
-                case 198:
-                    OPCODE_12(i1);
-                    OPCODE_6(i2);
-                    break;
-                case 199:
-                    OPCODE_12(i1);
-                    OPCODE_7(i2);
-                    break;
-                case 200:
-                    OPCODE_12(i1);
-                    OPCODE_8(i2);
-                    break;
-                case 201:
-                    OPCODE_12(i1);
-                    OPCODE_9(i2);
-                    break;
-                case 202:
-                    OPCODE_12(i1);
-                    OPCODE_10(i2);
-                    break;
-                case 203:
-                    OPCODE_12(i1);
-                    OPCODE_11(i2);
-                    break;
-                case 204:
-                    OPCODE_12(i1);
-                    OPCODE_12(i2);
-                    break;
-                case 205:
-                    OPCODE_12(i1);
-                    OPCODE_13(i2);
-                    break;
-                case 206:
-                    OPCODE_12(i1);
-                    OPCODE_14(i2);
-                    break;
-                case 207:
-                    OPCODE_12(i1);
-                    OPCODE_15(i2);
-                    break;
-                case 208:
-                    OPCODE_13(i1);
-                    OPCODE_0(i2);
-                    break;
-                case 209:
-                    OPCODE_13(i1);
-                    OPCODE_1(i2);
-                    break;
-                case 210:
-                    OPCODE_13(i1);
-                    OPCODE_2(i2);
-                    break;
-                case 211:
-                    OPCODE_13(i1);
-                    OPCODE_3(i2);
-                    break;
-                case 212:
-                    OPCODE_13(i1);
-                    OPCODE_4(i2);
-                    break;
-                case 213:
-                    OPCODE_13(i1);
-                    OPCODE_5(i2);
-                    break;
-                case 214:
-                    OPCODE_13(i1);
-                    OPCODE_6(i2);
-                    break;
-                case 215:
-                    OPCODE_13(i1);
-                    OPCODE_7(i2);
-                    break;
-                case 216:
-                    OPCODE_13(i1);
-                    OPCODE_8(i2);
-                    break;
-                case 217:
-                    OPCODE_13(i1);
-                    OPCODE_9(i2);
-                    break;
-                case 218:
-                    OPCODE_13(i1);
-                    OPCODE_10(i2);
-                    break;
-                case 219:
-                    OPCODE_13(i1);
-                    OPCODE_11(i2);
-                    break;
-                case 220:
-                    OPCODE_13(i1);
-                    OPCODE_12(i2);
-                    break;
-                case 221:
-                    OPCODE_13(i1);
-                    OPCODE_13(i2);
-                    break;
-                case 222:
-                    OPCODE_13(i1);
-                    OPCODE_14(i2);
-                    break;
-                case 223:
-                    OPCODE_13(i1);
-                    OPCODE_15(i2);
-                    break;
-                case 224:
-                    OPCODE_14(i1);
-                    OPCODE_0(i2);
-                    break;
-                case 225:
-                    OPCODE_14(i1);
-                    OPCODE_1(i2);
-                    break;
-                case 226:
-                    OPCODE_14(i1);
-                    OPCODE_2(i2);
-                    break;
-                case 227:
-                    OPCODE_14(i1);
-                    OPCODE_3(i2);
-                    break;
-                case 228:
-                    OPCODE_14(i1);
-                    OPCODE_4(i2);
-                    break;
-                case 229:
-                    OPCODE_14(i1);
-                    OPCODE_5(i2);
-                    break;
-                case 230:
-                    OPCODE_14(i1);
-                    OPCODE_6(i2);
-                    break;
-                case 231:
-                    OPCODE_14(i1);
-                    OPCODE_7(i2);
-                    break;
-                case 232:
-                    OPCODE_14(i1);
-                    OPCODE_8(i2);
-                    break;
-                case 233:
-                    OPCODE_14(i1);
-                    OPCODE_9(i2);
-                    break;
-                case 234:
-                    OPCODE_14(i1);
-                    OPCODE_10(i2);
-                    break;
-                case 235:
-                    OPCODE_14(i1);
-                    OPCODE_11(i2);
-                    break;
-                case 236:
-                    OPCODE_14(i1);
-                    OPCODE_12(i2);
-                    break;
-                case 237:
-                    OPCODE_14(i1);
-                    OPCODE_13(i2);
-                    break;
-                case 238:
-                    OPCODE_14(i1);
-                    OPCODE_14(i2);
-                    break;
-                case 239:
-                    OPCODE_14(i1);
-                    OPCODE_15(i2);
-                    break;
-                case 240:
-                    OPCODE_15(i1);
-                    OPCODE_0(i2);
-                    break;
-                case 241:
-                    OPCODE_15(i1);
-                    OPCODE_1(i2);
-                    break;
-                case 242:
-                    OPCODE_15(i1);
-                    OPCODE_2(i2);
-                    break;
-                case 243:
-                    OPCODE_15(i1);
-                    OPCODE_3(i2);
-                    break;
-                case 244:
-                    OPCODE_15(i1);
-                    OPCODE_4(i2);
-                    break;
-                case 245:
-                    OPCODE_15(i1);
-                    OPCODE_5(i2);
-                    break;
-                case 246:
-                    OPCODE_15(i1);
-                    OPCODE_6(i2);
-                    break;
-                case 247:
-                    OPCODE_15(i1);
-                    OPCODE_7(i2);
-                    break;
-                case 248:
-                    OPCODE_15(i1);
-                    OPCODE_8(i2);
-                    break;
-                case 249:
-                    OPCODE_15(i1);
-                    OPCODE_9(i2);
-                    break;
-                case 250:
-                    OPCODE_15(i1);
-                    OPCODE_10(i2);
-                    break;
-                case 251:
-                    OPCODE_15(i1);
-                    OPCODE_11(i2);
-                    break;
-                case 252:
-                    OPCODE_15(i1);
-                    OPCODE_12(i2);
-                    break;
-                case 253:
-                    OPCODE_15(i1);
-                    OPCODE_13(i2);
-                    break;
-                case 254:
-                    OPCODE_15(i1);
-                    OPCODE_14(i2);
-                    break;
-                case 255:
-                    OPCODE_15(i1);
-                    OPCODE_15(i2);
-                    break;
+                case 15: counter++; break;
+                SUPERINSTRUCTION_CASES
             }
         }
     }
+
+#if COMPILER_HAS_COMPUTED_GOTO
+    /**
+     * @brief Direct-threaded interpreter over the predecoded program. Each
+     * handler jumps straight to the handler for the next instruction, so
+     * there's one indirect branch per opcode rather than a single shared one
+     *
+     */
+    void run_loop_threaded() {
+        static void* const labels[16] {
+            &&op_0,
+            &&op_1,
+            &&op_2,
+            &&op_3,
+            &&op_4,
+            &&op_5,
+            &&op_6,
+            &&op_7,
+            &&op_8,
+            &&op_9,
+            &&op_10,
+            &&op_11,
+            &&op_12,
+            &&op_13,
+            &&op_14,
+            &&op_15};
+        if (halted) {
+            return;
+        }
+        refresh_decoded();
+        uint counter = program_counter;
+        decoded_instruction const* instruction_ptr = decoded.data();
+        decoded_instruction const* i1;
+
+#define DISPATCH()                                                             \
+    {                                                                          \
+        i1 = &instruction_ptr[counter++];                                      \
+        goto* labels[i1->op];                                                  \
+    }
+
+        DISPATCH();
+    op_0: OPCODE_0((*i1)); DISPATCH();
+    op_1: OPCODE_1((*i1)); DISPATCH();
+    op_2: OPCODE_2((*i1)); DISPATCH();
+    op_3: OPCODE_3((*i1)); DISPATCH();
+    op_4: OPCODE_4((*i1)); DISPATCH();
+    op_5: OPCODE_5((*i1)); DISPATCH();
+    op_6: OPCODE_6((*i1)); DISPATCH();
+    op_7: OPCODE_7((*i1));
+    op_8: OPCODE_8((*i1)); DISPATCH();
+    op_9: OPCODE_9((*i1)); DISPATCH();
+    op_10: OPCODE_10((*i1)); DISPATCH();
+    op_11: OPCODE_11((*i1)); DISPATCH();
+    op_12: LOAD_PROGRAM((*i1)); DISPATCH();
+    op_13: OPCODE_13((*i1)); DISPATCH();
+    op_14:
+    op_15: DISPATCH();
+
+#undef DISPATCH
+    }
+#endif
+
+   private:
+    // Executes a single instruction for the tail-call engines. Returns false
+    // if the machine halted
+    template <uint op, class Instruction, class Pointer>
+    bool tail_execute(
+        Instruction const& i1,
+        Pointer const*& instruction_ptr,
+        uint& counter) {
+        // Only the code for op is instantiated, since the specialized engine
+        // instantiates this for thousands of instructions
+        if constexpr (op == 0) {
+            OPCODE_0(i1);
+        } else if constexpr (op == 1) {
+            OPCODE_1(i1);
+        } else if constexpr (op == 2) {
+            OPCODE_2(i1);
+            instruction_ptr = program_start(instruction_ptr);
+        } else if constexpr (op == 3) {
+            OPCODE_3(i1);
+        } else if constexpr (op == 4) {
+            OPCODE_4(i1);
+        } else if constexpr (op == 5) {
+            OPCODE_5(i1);
+        } else if constexpr (op == 6) {
+            OPCODE_6(i1);
+        } else if constexpr (op == 7) {
+            halted = true;
+            io.flush();
+            return false;
+        } else if constexpr (op == 8) {
+            OPCODE_8(i1);
+        } else if constexpr (op == 9) {
+            OPCODE_9(i1);
+        } else if constexpr (op == 10) {
+            OPCODE_10(i1);
+        } else if constexpr (op == 11) {
+            OPCODE_11(i1);
+        } else if constexpr (op == 12) {
+            LOAD_PROGRAM(i1);
+        } else if constexpr (op == 13) {
+            OPCODE_13(i1);
+        }
+        return true;
+    }
+
+    // Runs the instruction at instruction_ptr[counter], then tail-calls the
+    // handler of the next one
+    template <uint op>
+    static void tail_call_handler(
+        machine& m,
+        decoded_instruction const* instruction_ptr,
+        uint counter) {
+        decoded_instruction const& i1 = instruction_ptr[counter++];
+        if (!m.tail_execute<op>(i1, instruction_ptr, counter)) {
+            return;
+        }
+        COMPILER_MUSTTAIL return instruction_ptr[counter].handler(
+            m,
+            instruction_ptr,
+            counter);
+    }
+
+    static tail_handler const* tail_handlers() {
+        static constexpr tail_handler handlers[16] {
+            &tail_call_handler<0>,
+            &tail_call_handler<1>,
+            &tail_call_handler<2>,
+            &tail_call_handler<3>,
+            &tail_call_handler<4>,
+            &tail_call_handler<5>,
+            &tail_call_handler<6>,
+            &tail_call_handler<7>,
+            &tail_call_handler<8>,
+            &tail_call_handler<9>,
+            &tail_call_handler<10>,
+            &tail_call_handler<11>,
+            &tail_call_handler<12>,
+            &tail_call_handler<13>,
+            &tail_call_handler<14>,
+            &tail_call_handler<15>};
+        return handlers;
+    }
+
+#if COMPILER_HAS_SPECIALIZED
+    /**
+     * @brief An instruction whose registers are known at compile time, so
+     * that reading them is a load from a fixed offset. Op 13 still reads its
+     * register from the word
+     *
+     */
+    template <uint a, uint b, uint c>
+    struct specialized_instruction : instruction {};
+
+    template <uint a, uint b, uint c>
+    uint get_A_register(specialized_instruction<a, b, c>) const {
+        return registers[a];
+    }
+    template <uint a, uint b, uint c>
+    uint get_B_register(specialized_instruction<a, b, c>) const {
+        return registers[b];
+    }
+    template <uint a, uint b, uint c>
+    uint get_C_register(specialized_instruction<a, b, c>) const {
+        return registers[c];
+    }
+    template <uint a, uint b, uint c>
+    void set_A_register(specialized_instruction<a, b, c>, uint value) {
+        registers[a] = value;
+    }
+    template <uint a, uint b, uint c>
+    void set_B_register(specialized_instruction<a, b, c>, uint value) {
+        registers[b] = value;
+    }
+    template <uint a, uint b, uint c>
+    void set_C_register(specialized_instruction<a, b, c>, uint value) {
+        registers[c] = value;
+    }
+
+    // The position of the handler for a word in specialized_handlers(): the
+    // opcode, followed by the low 9 bits, which hold registers A, B and C
+    static constexpr uint specialized_index(uint word) {
+        return ((word >> 19) & 0x1e00u) | (word & 0x1ffu);
+    }
+    // The register fields that the opcode at the given index reads. The
+    // others are left out, so that opcodes that ignore some of the fields
+    // don't get a handler for every value of them
+    static constexpr uint specialized_fields(uint index) {
+        uint op = index >> 9;
+        if (op <= 6) {
+            return index & 0x1ffu;
+        }
+        if (op == 8 || op == 12) {
+            return index & 0x3fu;
+        }
+        if (op >= 9 && op <= 11) {
+            return index & 0x7u;
+        }
+        return 0;
+    }
+
+    // Runs the word at instruction_ptr[counter], whose opcode and registers
+    // are op, a, b and c, then tail-calls the handler of the next one
+    template <uint op, uint a, uint b, uint c>
+    static void specialized_handler(
+        machine& m,
+        uint const* instruction_ptr,
+        uint counter) {
+        specialized_instruction<a, b, c> i1 {{instruction_ptr[counter++]}};
+        if (!m.tail_execute<op>(i1, instruction_ptr, counter)) {
+            return;
+        }
+        COMPILER_MUSTTAIL return specialized_handlers()[specialized_index(
+            instruction_ptr[counter])](m, instruction_ptr, counter);
+    }
+
+    template <size_t... index>
+    static constexpr std::array<word_handler, sizeof...(index)>
+    make_specialized_handlers(std::index_sequence<index...>) {
+        return {{&specialized_handler<
+            uint(index >> 9),
+            (specialized_fields(index) >> 6),
+            ((specialized_fields(index) >> 3) & 7),
+            (specialized_fields(index) & 7)>...}};
+    }
+
+    // One handler for every combination of opcode and registers
+    static word_handler const* specialized_handlers() {
+        static constexpr std::array<word_handler, 16 * 512> handlers
+            = make_specialized_handlers(std::make_index_sequence<16 * 512>());
+        return handlers.data();
+    }
+#endif
+
+   public:
+#if COMPILER_HAS_TAIL_CALLS
+    /**
+     * @brief Tail-call-threaded interpreter over the predecoded program. Each
+     * opcode has its own handler function, which ends by tail-calling the
+     * handler stored with the next instruction
+     *
+     */
+    void run_loop_tail_call() {
+        if (halted) {
+            return;
+        }
+        refresh_decoded();
+        decoded[program_counter].handler(
+            *this,
+            decoded.data(),
+            program_counter);
+    }
+#endif
+#if COMPILER_HAS_SPECIALIZED
+    /**
+     * @brief Tail-call-threaded interpreter that runs array 0 without
+     * decoding it. Every combination of opcode and registers has its own
+     * handler, with the registers fixed at compile time, and the handler for
+     * a word is found from its opcode and low 9 bits
+     *
+     */
+    void run_loop_specialized() {
+        if (halted) {
+            return;
+        }
+        uint const* instruction_ptr = arrays[0].data();
+        specialized_handlers()[specialized_index(
+            instruction_ptr[program_counter])](
+            *this,
+            instruction_ptr,
+            program_counter);
+    }
+#endif
 };
 } // namespace compiler
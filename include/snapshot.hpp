@@ -0,0 +1,317 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <machine.hpp>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+#include <word_array.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define COMPILER_HAS_MMAP_SNAPSHOTS 1
+#else
+#define COMPILER_HAS_MMAP_SNAPSHOTS 0
+#endif
+
+namespace compiler {
+/**
+ * @brief Saves the complete state of a machine to a file, and restores it.
+ * The file is laid out the way the machine is laid out in memory, so that
+ * restoring it is mostly a matter of mapping it:
+ *
+ * - A header with the registers, the program counter, and the head of the
+ *   list of free identifiers
+ * - The table of arrays, with a 64-bit entry for each identifier. An entry
+ *   holds the position of the array's words in the file. For a free
+ *   identifier, it holds the same tagged link to the next free identifier
+ *   that array_space keeps in memory
+ * - The storage of each array, exactly as word_array lays it out (reference
+ *   count, size, words, padding word), aligned to 16 bytes. Arrays that
+ *   share storage are saved once.
+ *
+ * Restored arrays use the mapped file as their storage. It's pinned (see
+ * word_array::pinned_refcount), so an array is copied the first time it's
+ * written to, and the file is never modified. The mapping is kept for the
+ * rest of the process, since restored storage may be in use until then.
+ *
+ */
+class snapshot {
+   public:
+    struct header {
+        char magic[8];
+        // byte_order, as written by the machine that saved the snapshot
+        uint32_t byte_order;
+        uint32_t version;
+        uint32_t program_counter;
+        uint32_t halted;
+        uint32_t registers[8];
+        uint32_t free_head;
+        uint32_t reserved;
+        uint64_t entry_count;
+        uint64_t table_offset;
+        uint64_t file_size;
+    };
+
+    static constexpr char magic[8] {'U', 'M', 'S', 'N', 'A', 'P', 0, 0};
+    static constexpr uint32_t byte_order = 0x01020304;
+    static constexpr uint32_t version = 1;
+    static constexpr size_t alignment = 16;
+
+   private:
+    static uint64_t align(uint64_t offset) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+    static size_t storage_bytes(size_t size) {
+        return sizeof(word_array::header) + (size + 1) * sizeof(uint);
+    }
+
+    [[noreturn]] static void fail_io(
+        char const* what,
+        std::filesystem::path const& filename) {
+        throw std::system_error(
+            errno,
+            std::generic_category(),
+            std::string(what) + " '" + filename.string() + "'");
+    }
+    [[noreturn]] static void fail_format(
+        std::filesystem::path const& filename) {
+        throw std::runtime_error(
+            "'" + filename.string() + "' isn't a valid snapshot");
+    }
+
+    // Returns the contents of the file. They're writable, but changes aren't
+    // written back to the file
+    static char* map_file(std::filesystem::path const& filename, size_t& size) {
+#if COMPILER_HAS_MMAP_SNAPSHOTS
+        int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fail_io("Couldn't open", filename);
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            fail_io("Couldn't read the size of", filename);
+        }
+        size = size_t(info.st_size);
+        if (size < sizeof(header)) {
+            close(fd);
+            fail_format(filename);
+        }
+        void* mapped = mmap(
+            nullptr,
+            size,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE,
+            fd,
+            0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            fail_io("Couldn't map", filename);
+        }
+        return static_cast<char*>(mapped);
+#else
+        std::ifstream file(filename, std::ios::binary);
+        if (!file) {
+            fail_io("Couldn't open", filename);
+        }
+        size = std::filesystem::file_size(filename);
+        if (size < sizeof(header)) {
+            fail_format(filename);
+        }
+        char* contents = static_cast<char*>(std::malloc(size));
+        if (contents == nullptr) {
+            throw std::bad_alloc();
+        }
+        file.read(contents, size);
+        return contents;
+#endif
+    }
+
+   public:
+    /**
+     * @brief Writes the machine to a file. Any buffered output is flushed
+     * first, since the console isn't part of the snapshot
+     *
+     */
+    static void save(machine& m, std::filesystem::path const& filename) {
+        array_space const& arrays = m.arrays;
+        // Addresses wouldn't mean anything once restored
+        if (arrays.uses_pointer_ids()) {
+            throw std::runtime_error(
+                "Machines that identify arrays by their addresses can't be "
+                "saved");
+        }
+        m.io.flush();
+
+        // Decide where everything goes. Entries that share storage point to
+        // the same place, and the storage counts how many of them there are
+        header h {};
+        std::memcpy(h.magic, magic, sizeof(magic));
+        h.byte_order = byte_order;
+        h.version = version;
+        h.program_counter = m.program_counter;
+        h.halted = m.halted;
+        std::memcpy(h.registers, m.registers.data(), sizeof(h.registers));
+        h.free_head = arrays.free_head;
+        h.entry_count = arrays.entries.size();
+        h.table_offset = align(sizeof(header));
+
+        std::vector<uint64_t> table(arrays.entries.size());
+        // Maps storage to its index in stored
+        std::unordered_map<uint const*, size_t> seen;
+        std::vector<uint const*> stored;
+        std::vector<uint64_t> positions;
+        std::vector<uint> references;
+        uint64_t end = align(h.table_offset + table.size() * sizeof(uint64_t));
+        for (size_t i = 0; i < table.size(); i++) {
+            uint const* words = arrays.entries[i].words;
+            uintptr_t raw = reinterpret_cast<uintptr_t>(words);
+            if (raw == 0 || array_space::is_free(arrays.entries[i])) {
+                table[i] = raw;
+                continue;
+            }
+            auto [it, inserted] = seen.try_emplace(words, stored.size());
+            if (inserted) {
+                stored.push_back(words);
+                positions.push_back(end + sizeof(word_array::header));
+                references.push_back(0);
+                end = align(end + storage_bytes(arrays.entries[i].size()));
+            }
+            table[i] = positions[it->second];
+            references[it->second]++;
+        }
+        h.file_size = end;
+
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            fail_io("Couldn't create", filename);
+        }
+        static constexpr char zeros[alignment] {};
+        uint64_t position = 0;
+        auto write = [&](void const* data, size_t bytes) {
+            file.write(static_cast<char const*>(data), bytes);
+            position += bytes;
+        };
+        auto pad = [&] { write(zeros, align(position) - position); };
+
+        write(&h, sizeof(h));
+        pad();
+        write(table.data(), table.size() * sizeof(uint64_t));
+        pad();
+        for (size_t i = 0; i < stored.size(); i++) {
+            word_array::header block = word_array::header_of(stored[i]);
+            block.refcount = word_array::pinned_refcount + references[i];
+            uint padding = 0;
+            write(&block, sizeof(block));
+            write(stored[i], block.size * sizeof(uint));
+            write(&padding, sizeof(padding));
+            pad();
+        }
+        if (!file.flush()) {
+            fail_io("Couldn't write", filename);
+        }
+    }
+
+    /**
+     * @brief Creates a machine from a snapshot file. It resumes from where
+     * the snapshot was taken when it's run
+     *
+     */
+    static machine restore(std::filesystem::path const& filename) {
+        size_t size = 0;
+        char* base = map_file(filename, size);
+        header const& h = *reinterpret_cast<header const*>(base);
+        uint64_t table_end = h.table_offset + h.entry_count * sizeof(uint64_t);
+        if (std::memcmp(h.magic, magic, sizeof(magic)) != 0
+            || h.byte_order != byte_order || h.version != version
+            || h.file_size != size || h.entry_count == 0
+            || h.table_offset < sizeof(header) || table_end > size) {
+            fail_format(filename);
+        }
+        uint64_t const* table = reinterpret_cast<uint64_t const*>(
+            base + h.table_offset);
+        // Everything is checked before the machine is built, since its
+        // arrays can't be destroyed while they hold entries that aren't valid
+        auto is_stored = [](uint64_t entry) {
+            return entry != 0 && (entry & 1) == 0;
+        };
+        size_t free_entries = 0;
+        for (size_t i = 0; i < h.entry_count; i++) {
+            uint64_t entry = table[i];
+            if (entry & 1) {
+                // A free entry holds the next free identifier
+                if ((entry >> 1) >= h.entry_count) {
+                    fail_format(filename);
+                }
+                free_entries++;
+            } else if (entry != 0) {
+                // Check that the storage lies within the file. The start is
+                // compared against the size first, so that size - start
+                // can't wrap around
+                uint64_t start = entry - sizeof(word_array::header);
+                if (entry < table_end || entry % alignment != 8
+                    || start > size || storage_bytes(0) > size - start) {
+                    fail_format(filename);
+                }
+                uint words = word_array::header_of(
+                                 reinterpret_cast<uint const*>(base + entry))
+                                 .size;
+                if (storage_bytes(words) > size - start) {
+                    fail_format(filename);
+                }
+            }
+        }
+        // The free list has to go through every free entry once, and end
+        // with 0
+        size_t linked = 0;
+        for (uint64_t id = h.free_head; id != 0; id = table[id] >> 1) {
+            if (id >= h.entry_count || (table[id] & 1) == 0
+                || linked == free_entries) {
+                fail_format(filename);
+            }
+            linked++;
+        }
+        if (linked != free_entries || !is_stored(table[0])) {
+            fail_format(filename);
+        }
+        uint program_size = word_array::header_of(
+                                reinterpret_cast<uint const*>(base + table[0]))
+                                .size;
+        if (h.halted == 0 && h.program_counter >= program_size) {
+            fail_format(filename);
+        }
+
+        machine m;
+        std::memcpy(m.registers.data(), h.registers, sizeof(h.registers));
+        m.program_counter = h.program_counter;
+        m.halted = h.halted != 0;
+        array_space& arrays = m.arrays;
+        arrays.entries.resize(h.entry_count);
+        for (size_t i = 0; i < h.entry_count; i++) {
+            uint64_t entry = table[i];
+            if (is_stored(entry)) {
+                arrays.entries[i].words = reinterpret_cast<uint*>(
+                    base + entry);
+            } else {
+                arrays.entries[i].words = reinterpret_cast<uint*>(
+                    uintptr_t(entry));
+            }
+        }
+        arrays.free_head = h.free_head;
+        arrays.recount();
+        m.decoded_stale = true;
+        return m;
+    }
+};
+} // namespace compiler
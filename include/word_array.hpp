@@ -0,0 +1,192 @@
+#pragma once
+
+#include <arena.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ins.hpp>
+#include <utility>
+
+namespace compiler {
+/**
+ * @brief An array of words with copy-on-write storage. Copying a word_array
+ * only increments a reference count; the words themselves are duplicated the
+ * first time one of the copies is written to.
+ *
+ * The storage is a single block: a header with the reference count and the
+ * size, followed by the words, followed by one extra padding word. Because
+ * every array is already padded, array 0 can share storage with the array it
+ * was loaded from.
+ *
+ */
+class word_array {
+   public:
+    struct header {
+        uint refcount;
+        uint size;
+    };
+    // Where the reference count lives, relative to data()
+    static constexpr int refcount_offset = -int(sizeof(header))
+                                         + int(offsetof(header, refcount));
+    // Storage that doesn't come from the arena (such as a restored snapshot)
+    // starts with a reference count of at least this. The count never drops
+    // to 0, so the storage is never freed, and it always looks shared, so
+    // it's copied before it's written to
+    static constexpr uint pinned_refcount = uint(1) << 31;
+
+   private:
+    // Points just past the header, or is null for an empty array without
+    // storage
+    uint* words = nullptr;
+
+    // Keeps its free list in the entries of freed arrays
+    friend class array_space;
+    friend class snapshot;
+
+    // The header comes right before the words. It's found by subtracting
+    // from their address as an integer, since indexing before the words
+    // makes compilers warn that it's out of bounds
+    static header* header_before(uint* words) {
+        return reinterpret_cast<header*>(
+            reinterpret_cast<uintptr_t>(words) - sizeof(header));
+    }
+    header& get_header() const { return *header_before(words); }
+
+    static size_t block_bytes(size_t size) {
+        return sizeof(header) + (size + 1) * sizeof(uint);
+    }
+    // Creates a block with room for size words plus the padding word. The
+    // words are only zeroed if zeroed is true; the padding word always is
+    static uint* create(size_t size, bool zeroed) {
+        void* block = arena::local().allocate(block_bytes(size), zeroed);
+        header* h = static_cast<header*>(block);
+        h->refcount = 1;
+        h->size = uint(size);
+        uint* result = reinterpret_cast<uint*>(h + 1);
+        result[size] = 0;
+        return result;
+    }
+    void release() {
+        if (words != nullptr && --get_header().refcount == 0) {
+            arena::local().deallocate(&get_header(), block_bytes(size()));
+        }
+        words = nullptr;
+    }
+    // Gives this array its own copy of the words
+    void detach() {
+        size_t count = size();
+        uint* copy = create(count, false);
+        std::memcpy(copy, words, count * sizeof(uint));
+        release();
+        words = copy;
+    }
+
+   public:
+    word_array() = default;
+    /**
+     * @brief Creates an array of the given size, with every word set to 0
+     *
+     */
+    explicit word_array(size_t size)
+      : words(create(size, true)) {}
+    /**
+     * @brief Creates an array holding a copy of count words starting at
+     * source
+     *
+     */
+    word_array(uint const* source, size_t count)
+      : words(create(count, false)) {
+        std::memcpy(words, source, count * sizeof(uint));
+    }
+    /**
+     * @brief Creates an array of the given size, without initializing the
+     * words. They have to be filled in through mutable_data()
+     *
+     */
+    static word_array uninitialized(size_t size) {
+        word_array result;
+        result.words = create(size, false);
+        return result;
+    }
+    word_array(word_array const& other) noexcept
+      : words(other.words) {
+        if (words != nullptr) {
+            get_header().refcount++;
+        }
+    }
+    word_array(word_array&& other) noexcept
+      : words(std::exchange(other.words, nullptr)) {}
+    word_array& operator=(word_array const& other) noexcept {
+        word_array(other).swap(*this);
+        return *this;
+    }
+    word_array& operator=(word_array&& other) noexcept {
+        word_array(std::move(other)).swap(*this);
+        return *this;
+    }
+    ~word_array() { release(); }
+
+    void swap(word_array& other) noexcept { std::swap(words, other.words); }
+
+    size_t size() const { return words == nullptr ? 0 : get_header().size; }
+    bool empty() const { return size() == 0; }
+    /**
+     * @brief Returns the words in the array. data()[size()] is a padding word
+     * that isn't part of the array; it starts out as 0, but array_space may
+     * use it. The result can't be written to, since the words may be shared;
+     * use set() instead
+     *
+     */
+    uint const* data() const { return words; }
+    uint const* begin() const { return words; }
+    uint const* end() const { return words + size(); }
+    uint operator[](size_t index) const { return words[index]; }
+
+    /**
+     * @brief Writes a word, first copying the array if its storage is shared
+     * with another array
+     *
+     */
+    void set(size_t index, uint value) {
+        if (is_shared(words)) {
+            detach();
+        }
+        words[index] = value;
+    }
+    static header const& header_of(uint const* words) {
+        return *header_before(const_cast<uint*>(words));
+    }
+    /**
+     * @brief Returns true if the storage with the given words is shared by
+     * more than one array
+     *
+     */
+    static bool is_shared(uint const* words) {
+        return header_of(words).refcount != 1;
+    }
+    /**
+     * @brief Returns the words for writing, first copying the array if its
+     * storage is shared with another array
+     *
+     */
+    uint* mutable_data() {
+        if (words != nullptr && is_shared(words)) {
+            detach();
+        }
+        return words;
+    }
+    /**
+     * @brief Returns true if both arrays refer to the same storage, in which
+     * case they're guaranteed to hold the same words
+     *
+     */
+    bool shares_storage_with(word_array const& other) const {
+        return words == other.words;
+    }
+    /**
+     * @brief Releases the storage, leaving the array empty
+     *
+     */
+    void clear() { release(); }
+};
+} // namespace compiler
@@ -0,0 +1,371 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <engine.hpp>
+#include <files.hpp>
+#include <fmt/core.h>
+#include <fmt/os.h>
+#include <formatting.hpp>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#define COMPILER_HAS_CPU_PINNING 1
+#else
+#define COMPILER_HAS_CPU_PINNING 0
+#endif
+
+namespace {
+namespace fs = std::filesystem;
+using namespace compiler;
+using clock_type = std::chrono::steady_clock;
+
+/**
+ * @brief One line of the manifest: a program, the file its input comes from,
+ * and the file its output goes to. Either file may be -, for no input or for
+ * discarding the output
+ *
+ */
+struct job {
+    fs::path program;
+    std::string input;
+    std::string output;
+};
+
+struct job_result {
+    double seconds = 0;
+    size_t worker = 0;
+    // Empty if the job ran to completion
+    std::string error;
+};
+
+/**
+ * @brief Reads the manifest. Each line is `<program> <input> <output>`, with
+ * paths relative to the manifest, and lines starting with # are comments
+ *
+ */
+std::vector<job> read_manifest(fs::path const& filename) {
+    std::ifstream file(filename);
+    if (!file) {
+        throw std::runtime_error(
+            "Couldn't open '" + filename.string() + "'");
+    }
+    fs::path base = filename.parent_path();
+    auto resolve = [&](std::string const& path) {
+        return path == "-" ? path : (base / path).string();
+    };
+    std::vector<job> jobs;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string program, input, output;
+        fields >> program >> input >> output;
+        if (!fields) {
+            throw std::runtime_error("Malformed line in manifest: " + line);
+        }
+        jobs.push_back(job {base / program, resolve(input), resolve(output)});
+    }
+    return jobs;
+}
+
+/**
+ * @brief The jobs waiting for one worker. The worker takes jobs from the
+ * back, and other workers that have run out steal from the front
+ *
+ */
+class work_queue {
+    std::mutex m;
+    std::deque<size_t> jobs;
+
+   public:
+    void push(size_t index) {
+        std::lock_guard lock(m);
+        jobs.push_back(index);
+    }
+    std::optional<size_t> pop() {
+        std::lock_guard lock(m);
+        if (jobs.empty()) {
+            return std::nullopt;
+        }
+        size_t index = jobs.back();
+        jobs.pop_back();
+        return index;
+    }
+    std::optional<size_t> steal() {
+        std::lock_guard lock(m);
+        if (jobs.empty()) {
+            return std::nullopt;
+        }
+        size_t index = jobs.front();
+        jobs.pop_front();
+        return index;
+    }
+};
+
+/**
+ * @brief Runs jobs on a thread pool. Each worker has its own queue, and a
+ * machine per job. Programs are loaded once per worker, and each machine gets
+ * a copy-on-write duplicate, so jobs running the same program share its
+ * words until they write to them. Arrays aren't shared between workers,
+ * since their reference counts aren't atomic
+ *
+ */
+class batch {
+    std::vector<job> const& jobs;
+    std::vector<job_result> results;
+    std::vector<work_queue> queues;
+    engine kind;
+    bool pin;
+    std::atomic<size_t> pinning_failures {0};
+
+    std::optional<size_t> next_job(size_t worker) {
+        if (auto index = queues[worker].pop()) {
+            return index;
+        }
+        for (size_t i = 1; i < queues.size(); i++) {
+            if (auto index = queues[(worker + i) % queues.size()].steal()) {
+                return index;
+            }
+        }
+        return std::nullopt;
+    }
+
+    void run_job(job const& j, std::map<fs::path, word_array>& programs) {
+        auto it = programs.find(j.program);
+        if (it == programs.end()) {
+            it = programs.emplace(j.program, read_program(j.program)).first;
+        }
+
+        std::string input;
+        if (j.input != "-") {
+            std::ifstream file(j.input, std::ios::binary);
+            if (!file) {
+                throw std::runtime_error("Couldn't open '" + j.input + "'");
+            }
+            input.assign(std::istreambuf_iterator<char>(file), {});
+        }
+        std::shared_ptr<output_sink> sink = std::make_shared<null_sink>();
+        std::unique_ptr<std::FILE, int (*)(std::FILE*)> output(
+            nullptr,
+            std::fclose);
+        if (j.output != "-") {
+            output.reset(std::fopen(j.output.c_str(), "wb"));
+            if (!output) {
+                throw std::runtime_error(
+                    "Couldn't create '" + j.output + "'");
+            }
+            sink = std::make_shared<stdio_sink>(output.get());
+        }
+
+        machine m(it->second);
+        m.set_console(
+            console(sink, std::make_shared<string_source>(std::move(input))));
+        run(m, kind);
+        m.get_console().flush();
+    }
+
+    void work(size_t worker) {
+        if (pin && !pin_to_cpu(worker)) {
+            pinning_failures++;
+        }
+        std::map<fs::path, word_array> programs;
+        while (auto index = next_job(worker)) {
+            job_result& result = results[*index];
+            result.worker = worker;
+            auto start = clock_type::now();
+            try {
+                run_job(jobs[*index], programs);
+            } catch (std::exception const& e) {
+                result.error = e.what();
+            }
+            result.seconds = std::chrono::duration<double>(
+                                 clock_type::now() - start)
+                                 .count();
+        }
+    }
+
+    static bool pin_to_cpu(size_t worker) {
+#if COMPILER_HAS_CPU_PINNING
+        size_t cpus = std::max(std::thread::hardware_concurrency(), 1u);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(worker % cpus, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        (void)worker;
+        return false;
+#endif
+    }
+
+   public:
+    batch(std::vector<job> const& jobs, size_t threads, engine kind, bool pin)
+      : jobs(jobs)
+      , results(jobs.size())
+      , queues(threads)
+      , kind(kind)
+      , pin(pin) {
+        // Deal the jobs out in turn, so each worker starts with a share of
+        // every part of the manifest
+        for (size_t i = 0; i < jobs.size(); i++) {
+            queues[i % threads].push(i);
+        }
+    }
+
+    std::vector<job_result> const& run_all() {
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < queues.size(); i++) {
+            workers.emplace_back([this, i] { work(i); });
+        }
+        work(0);
+        for (std::thread& t : workers) {
+            t.join();
+        }
+        return results;
+    }
+    size_t failed_pinnings() const { return pinning_failures; }
+};
+
+// Nearest rank
+double percentile(std::vector<double> const& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = size_t(std::ceil(p * double(sorted.size())));
+    return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+void print_usage(char const* program) {
+    fmt::print(
+        stderr,
+        "Usage: \n\n\t{} [options] <manifest>\n\n"
+        "Runs every job in the manifest, each on its own machine, on a pool "
+        "of threads.\nEach line of the manifest is `<program> <input file> "
+        "<output file>`, with\npaths relative to the manifest; - stands for "
+        "no input, or for discarding\nthe output. Workers take jobs from "
+        "their own queue, and steal from the\nothers once it's empty.\n\n"
+        "Options:\n"
+        "\t--threads <n>      workers (default: one per CPU)\n"
+        "\t--engine <name>    engine to run the jobs with\n"
+        "\t--pin              pin each worker to a CPU (Linux only)\n"
+        "\t--report <file>    write the latency of each job as JSON\n\n",
+        program);
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+    engine kind = default_engine;
+    bool pin = false;
+    char const* report_arg = nullptr;
+    char const* manifest_arg = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = std::max<size_t>(std::stoul(argv[++i]), 1);
+        } else if (arg == "--engine" && i + 1 < argc) {
+            auto selected = find_engine(argv[++i]);
+            if (!selected) {
+                fmt::print(stderr, "Unknown engine '{}'\n", argv[i]);
+                return 1;
+            }
+            kind = *selected;
+        } else if (arg == "--pin") {
+            pin = true;
+        } else if (arg == "--report" && i + 1 < argc) {
+            report_arg = argv[++i];
+        } else if (arg == "--help") {
+            print_usage(argv[0]);
+            return 0;
+        } else {
+            manifest_arg = argv[i];
+        }
+    }
+    if (manifest_arg == nullptr) {
+        fmt::print(stderr, "Missing manifest. ");
+        print_usage(argv[0]);
+        return 0;
+    }
+
+    std::vector<job> jobs = read_manifest(manifest_arg);
+    threads = std::min(threads, std::max<size_t>(jobs.size(), 1));
+    batch b(jobs, threads, kind, pin);
+    auto start = clock_type::now();
+    std::vector<job_result> const& results = b.run_all();
+    double wall = std::chrono::duration<double>(clock_type::now() - start)
+                      .count();
+
+    if (pin && b.failed_pinnings() != 0) {
+        fmt::print(
+            stderr,
+            "Couldn't pin {} of the workers to a CPU\n",
+            b.failed_pinnings());
+    }
+    std::vector<double> latencies;
+    size_t failures = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        latencies.push_back(results[i].seconds);
+        if (!results[i].error.empty()) {
+            failures++;
+            fmt::print(
+                stderr,
+                "Job {} ({}) failed: {}\n",
+                i + 1,
+                jobs[i].program.string(),
+                results[i].error);
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+    fmt::print(
+        stderr,
+        "{} jobs ({} failed) on {} threads in {:.3f}s: {:.1f} jobs/s\n"
+        "latency: median {:.3f}ms  p95 {:.3f}ms  p99 {:.3f}ms  max "
+        "{:.3f}ms\n",
+        jobs.size(),
+        failures,
+        threads,
+        wall,
+        wall > 0 ? double(jobs.size()) / wall : 0,
+        percentile(latencies, 0.5) * 1e3,
+        percentile(latencies, 0.95) * 1e3,
+        percentile(latencies, 0.99) * 1e3,
+        latencies.empty() ? 0 : latencies.back() * 1e3);
+
+    if (report_arg != nullptr) {
+        auto out = fmt::output_file(report_arg);
+        out.print(
+            "{{\n  \"threads\": {},\n  \"engine\": {},\n  \"seconds\": {},\n"
+            "  \"jobs\": [",
+            threads,
+            json_string(get_engine_info(kind).name),
+            wall);
+        for (size_t i = 0; i < results.size(); i++) {
+            out.print(
+                "{}\n    {{\"program\": {}, \"output\": {}, \"seconds\": {}, "
+                "\"worker\": {}, \"error\": {}}}",
+                i == 0 ? "" : ",",
+                json_string(jobs[i].program.string()),
+                json_string(jobs[i].output),
+                results[i].seconds,
+                results[i].worker,
+                results[i].error.empty() ? "null"
+                                         : json_string(results[i].error));
+        }
+        out.print("\n  ]\n}}\n");
+    }
+    return failures == 0 ? 0 : 2;
+}
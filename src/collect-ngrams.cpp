@@ -0,0 +1,119 @@
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace {
+/**
+ * @brief Counts how often each sequence of 2 to max_length opcodes is
+ * executed back to back, at consecutive positions in array 0. Sequences are
+ * stored as base-16 numbers, one digit per opcode.
+ *
+ */
+struct ngram_recorder {
+    static constexpr unsigned max_length = 5;
+
+    // counts[n] holds the counts for sequences of length n
+    std::vector<uint64_t> counts[max_length + 1];
+    uint64_t total = 0;
+    uint32_t window = 0;
+    unsigned window_length = 0;
+    uint32_t last_pc = ~uint32_t(0);
+
+    ngram_recorder() {
+        for (unsigned n = 2; n <= max_length; n++) {
+            counts[n].resize(size_t(1) << (4 * n));
+        }
+    }
+
+    void record(uint32_t pc, uint32_t op) {
+        total++;
+        // A jump starts a new sequence
+        if (pc != last_pc + 1) {
+            window_length = 0;
+        }
+        last_pc = pc;
+        window = (window << 4 | op) & ((uint32_t(1) << (4 * max_length)) - 1);
+        if (window_length < max_length) {
+            window_length++;
+        }
+        for (unsigned n = 2; n <= window_length; n++) {
+            counts[n][window & ((uint32_t(1) << (4 * n)) - 1)]++;
+        }
+        // Only the last instruction of a sequence can halt or load a program
+        if (op == 7 || op == 12) {
+            window_length = 0;
+        }
+    }
+};
+
+ngram_recorder recorder;
+} // namespace
+
+#define COMPILER_ON_INSTRUCTION(PC, INS) recorder.record(PC, INS.get_OP())
+
+#include <algorithm>
+#include <files.hpp>
+#include <fmt/core.h>
+#include <fmt/os.h>
+
+int main(int argc, char** argv) {
+    namespace fs = std::filesystem;
+    using namespace compiler;
+
+    // Check that a filename was provided as input
+    if (argc < 3) {
+        fmt::print(
+            stderr,
+            "Missing filename. Usage: \n\n\t{} <program> <output> "
+            "[max entries]\n\n"
+            "Runs the program, and writes the most frequently executed "
+            "sequences of\nopcodes to the output file. This file can be "
+            "placed in the profiles\ndirectory to generate "
+            "superinstructions from it.\n\n",
+            argv[0]);
+        return 0;
+    }
+
+    fs::path filename = argv[1];
+    size_t max_entries = argc > 3 ? std::stoul(argv[3]) : 200;
+
+    if (!fs::exists(filename)) {
+        fmt::print("Couldn't find '{}'\n", filename.c_str());
+        return 1;
+    }
+
+    machine m = load_from_file(filename);
+    m.run_loop();
+
+    struct entry {
+        uint64_t count;
+        unsigned length;
+        uint32_t ops;
+    };
+    std::vector<entry> entries;
+    for (unsigned n = 2; n <= ngram_recorder::max_length; n++) {
+        for (uint32_t ops = 0; ops < recorder.counts[n].size(); ops++) {
+            if (recorder.counts[n][ops] != 0) {
+                entries.push_back(entry {recorder.counts[n][ops], n, ops});
+            }
+        }
+    }
+    std::sort(entries.begin(), entries.end(), [](auto& a, auto& b) {
+        return a.count > b.count;
+    });
+    entries.resize(std::min(entries.size(), max_entries));
+
+    auto out = fmt::output_file(argv[2]);
+    out.print(
+        "# Opcode sequences executed by {}\n",
+        filename.filename().c_str());
+    out.print("# Each line is: <count> <opcodes...>\n");
+    out.print("instructions {}\n", recorder.total);
+    for (entry const& e : entries) {
+        out.print("{}", e.count);
+        for (unsigned i = e.length; i-- > 0;) {
+            out.print(" {}", (e.ops >> (4 * i)) & 0xf);
+        }
+        out.print("\n");
+    }
+}
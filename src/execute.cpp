@@ -1,32 +1,347 @@
+#include <engine.hpp>
 #include <files.hpp>
 #include <fmt/core.h>
+#include <optional>
+#include <snapshot.hpp>
+#include <string>
+#include <string_view>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/wait.h>
+#include <unistd.h>
+#define COMPILER_HAS_FORK 1
+#else
+#define COMPILER_HAS_FORK 0
+#endif
+
+namespace {
+using namespace compiler;
+
+void print_usage(char const* program) {
+    fmt::print(
+        stderr,
+        "Usage: \n\n\t{} [--engine <name>] [--jit] [--pointer-ids] "
+        "[--io <mode>] [--save <snapshot>] [--save-after <count>] "
+        "[--instances <n> [--fork]] [--memory-limit <MiB>] [--memory-stats] "
+        "[--huge-pages] <filename>\n"
+        "\t{} [options] --restore <snapshot>\n\n"
+        "--pointer-ids identifies arrays by their addresses where "
+        "possible\n"
+        "--save writes a snapshot of the machine when it halts, or after "
+        "--save-after\n"
+        "\tinstructions have run (in which case it doesn't run any "
+        "further)\n"
+        "--restore resumes a machine from a snapshot instead of loading a "
+        "program\n"
+        "--instances loads the program (or snapshot) once, and runs that many "
+        "clones of\n\tit one after another. With --fork, each one runs in a "
+        "child process, all at\n\tonce\n"
+        "--memory-limit stops the machine if its arrays would take up more "
+        "than that\n\tmuch memory\n"
+        "--memory-stats prints how much memory the arrays took up once the "
+        "machine\n\thalts\n"
+        "--huge-pages backs arrays of 2MB or more with transparent huge "
+        "pages, where\n\tthe system supports them\n\n"
+        "I/O modes:\n"
+        "\tbuffered    buffer input and output (the default)\n"
+        "\tthreaded    buffer, and write output from a separate thread\n"
+        "\tstdio       go through stdio a character at a time\n\n"
+        "Engines:\n",
+        program,
+        program);
+    for (auto const& info : engines) {
+        fmt::print(
+            stderr,
+            "\t{:<12}{}{}\n",
+            info.name,
+            info.description,
+            info.available ? "" : " (not available)");
+    }
+    fmt::print(stderr, "\n");
+}
+
+console make_console(std::string_view io_mode) {
+    if (io_mode == "threaded") {
+        return console::threaded();
+    }
+    if (io_mode == "stdio") {
+        return console::compatible();
+    }
+    return console::standard();
+}
+
+void enable_pointer_ids(machine& m, bool report = true) {
+    if (!m.enable_pointer_ids() && report) {
+        fmt::print(
+            stderr,
+            "Pointer identifiers aren't supported on this platform\n");
+    }
+}
+
+/**
+ * @brief Runs the machine until it halts, or until it goes over its memory
+ * limit, which is reported. If fuel is given, the switch engine runs at most
+ * that many instructions instead
+ *
+ * @return false if it went over its memory limit
+ */
+bool run_within_limit(
+    machine& m,
+    engine kind,
+    bool memory_stats,
+    std::optional<uint64_t> fuel = std::nullopt) {
+    try {
+        if (fuel) {
+            m.run_loop_for(*fuel);
+        } else {
+            run(m, kind);
+        }
+    } catch (memory_limit_exceeded const& e) {
+        m.get_console().flush();
+        fmt::print(stderr, "The machine ran out of memory: {}\n", e.what());
+        return false;
+    }
+    if (memory_stats) {
+        memory_usage usage = m.get_memory_usage();
+        fmt::print(
+            stderr,
+            "{} arrays holding {} words, {} entries in the table of "
+            "arrays\n{:.1f} MiB taken from the system, {:.1f} MiB of it in "
+            "free blocks\n",
+            usage.arrays,
+            usage.words,
+            usage.table_entries,
+            double(usage.reserved_bytes) / (1 << 20),
+            double(usage.cached_bytes) / (1 << 20));
+    }
+    return true;
+}
+
+machine start_instance(
+    machine const& image,
+    size_t index,
+    bool pointer_ids,
+    std::string_view io_mode) {
+    machine instance = image.clone(make_console(io_mode));
+    if (pointer_ids) {
+        // Only the first instance says so if they aren't supported
+        enable_pointer_ids(instance, index == 0);
+    }
+    return instance;
+}
+
+/**
+ * @brief Runs count instances of the image. In-process instances are clones,
+ * which share the arrays of the image until they write to them, and run one
+ * after another, since arrays can't be shared between threads. Forked
+ * instances run at once, and share the pages of the image the same way
+ * through the kernel
+ *
+ * @return the exit status: 0 if every instance ran to completion
+ */
+int run_instances(
+    machine const& image,
+    size_t count,
+    bool use_fork,
+    engine kind,
+    bool pointer_ids,
+    std::string_view io_mode,
+    bool memory_stats) {
+    if (!use_fork) {
+        size_t failures = 0;
+        for (size_t i = 0; i < count; i++) {
+            machine instance = start_instance(image, i, pointer_ids, io_mode);
+            if (!run_within_limit(instance, kind, memory_stats)) {
+                failures++;
+            }
+        }
+        return failures == 0 ? 0 : 2;
+    }
+#if COMPILER_HAS_FORK
+    size_t failures = 0;
+    for (size_t i = 0; i < count; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            fmt::print(stderr, "Couldn't start instance {}\n", i + 1);
+            failures += count - i;
+            break;
+        }
+        if (pid == 0) {
+            int status = 0;
+            try {
+                machine instance
+                    = start_instance(image, i, pointer_ids, io_mode);
+                status = run_within_limit(instance, kind, memory_stats) ? 0 : 1;
+            } catch (std::exception const& e) {
+                fmt::print(stderr, "Instance {} failed: {}\n", i + 1, e.what());
+                status = 1;
+            }
+            // The console has been flushed by now, and nothing else of the
+            // parent's should be cleaned up twice
+            _exit(status);
+        }
+    }
+    int status;
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failures++;
+        }
+    }
+    return failures == 0 ? 0 : 2;
+#else
+    fmt::print(stderr, "--fork isn't supported on this platform\n");
+    return 1;
+#endif
+}
+} // namespace
 
 int main(int argc, char** argv) {
     namespace fs = std::filesystem;
-    using namespace compiler;
+
+    engine kind = default_engine;
+    bool pointer_ids = false;
+    std::string_view io_mode = "buffered";
+    char const* filename_arg = nullptr;
+    char const* save_arg = nullptr;
+    char const* restore_arg = nullptr;
+    std::optional<uint64_t> save_after;
+    size_t instances = 0;
+    bool use_fork = false;
+    std::optional<size_t> memory_limit;
+    bool memory_stats = false;
+
+    // Read flags. --jit is shorthand for --engine jit
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        std::string_view engine_name;
+        if (arg == "--jit") {
+            engine_name = "jit";
+        } else if (arg == "--engine" && i + 1 < argc) {
+            engine_name = argv[++i];
+        } else if (arg.substr(0, 9) == "--engine=") {
+            engine_name = arg.substr(9);
+        } else if (arg == "--io" && i + 1 < argc) {
+            io_mode = argv[++i];
+            if (io_mode != "buffered" && io_mode != "threaded"
+                && io_mode != "stdio") {
+                fmt::print(stderr, "Unknown I/O mode '{}'\n", io_mode);
+                print_usage(argv[0]);
+                return 1;
+            }
+            continue;
+        } else if (arg == "--save" && i + 1 < argc) {
+            save_arg = argv[++i];
+            continue;
+        } else if (arg == "--save-after" && i + 1 < argc) {
+            save_after = std::stoull(argv[++i]);
+            continue;
+        } else if (arg == "--restore" && i + 1 < argc) {
+            restore_arg = argv[++i];
+            continue;
+        } else if (arg == "--instances" && i + 1 < argc) {
+            instances = std::stoul(argv[++i]);
+            continue;
+        } else if (arg == "--fork") {
+            use_fork = true;
+            continue;
+        } else if (arg == "--memory-limit" && i + 1 < argc) {
+            memory_limit = size_t(std::stoull(argv[++i])) << 20;
+            continue;
+        } else if (arg == "--memory-stats") {
+            memory_stats = true;
+            continue;
+        } else if (arg == "--huge-pages") {
+            arena::use_huge_pages(true);
+            continue;
+        } else if (arg == "--pointer-ids") {
+            pointer_ids = true;
+            continue;
+        } else if (arg == "--help") {
+            print_usage(argv[0]);
+            return 0;
+        } else {
+            filename_arg = argv[i];
+            continue;
+        }
+
+        auto selected = find_engine(engine_name);
+        if (!selected) {
+            fmt::print(stderr, "Unknown engine '{}'\n", engine_name);
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (!get_engine_info(*selected).available) {
+            fmt::print(
+                stderr,
+                "Engine '{}' isn't available in this build\n",
+                engine_name);
+            return 1;
+        }
+        kind = *selected;
+    }
+
+    if (save_after && save_arg == nullptr) {
+        fmt::print(stderr, "--save-after needs --save. ");
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (instances != 0 && save_arg != nullptr) {
+        fmt::print(stderr, "--instances can't be used with --save. ");
+        print_usage(argv[0]);
+        return 1;
+    }
 
     // Check that a filename was provided as input
-    if (argc == 1) {
-        fmt::print(
-            stderr,
-            "Missing filename. Usage: \n\n\t{} <filename>\n\n",
-            argv[0]);
+    if (filename_arg == nullptr && restore_arg == nullptr) {
+        fmt::print(stderr, "Missing filename. ");
+        print_usage(argv[0]);
         return 0;
     }
 
-    // Get the name of the file from the first argument
-    fs::path filename = argv[1];
+    // Get the name of the file
+    fs::path filename = restore_arg ? restore_arg : filename_arg;
 
     // Execute the file as a program if it exists.
     if (fs::exists(filename)) {
 
         // fmt::print("Loading '{}'\n", filename.c_str());
-        // Load the machine from a file
-        machine m = load_from_file(filename);
+        // Load the machine from a file, or pick up where a snapshot left off
+        machine m = restore_arg ? snapshot::restore(filename)
+                                : load_from_file(filename);
+        if (memory_limit) {
+            m.set_memory_limit(*memory_limit);
+        }
+        if (instances != 0) {
+            return run_instances(
+                m,
+                instances,
+                use_fork,
+                kind,
+                pointer_ids,
+                io_mode,
+                memory_stats);
+        }
+        if (io_mode != "buffered") {
+            m.set_console(make_console(io_mode));
+        }
+        if (pointer_ids && save_arg != nullptr) {
+            fmt::print(
+                stderr,
+                "Machines using pointer identifiers can't be saved, so "
+                "--pointer-ids is ignored\n");
+        } else if (pointer_ids) {
+            enable_pointer_ids(m);
+        }
 
         // fmt::print("Running '{}'\n", filename.c_str());
-        // Run the machine
-        m.run_loop_vectorized();
+        // Run the machine. Only the switch engine can stop partway through
+        if (!run_within_limit(m, kind, memory_stats, save_after)) {
+            return 1;
+        }
+        if (save_arg != nullptr) {
+            snapshot::save(m, save_arg);
+        }
     } else {
         fmt::print("Couldn't find '{}'\n", filename.c_str());
     }
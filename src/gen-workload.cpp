@@ -0,0 +1,387 @@
+#include <algorithm>
+#include <assembler.hpp>
+#include <cmath>
+#include <fmt/core.h>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <string_view>
+
+namespace {
+using namespace compiler;
+using label = assembler::label;
+
+/**
+ * @brief The parameters given on the command line, as --name value
+ *
+ */
+class parameters {
+    std::map<std::string, std::string, std::less<>> values;
+
+   public:
+    void set(std::string name, std::string value) {
+        values[std::move(name)] = std::move(value);
+    }
+    uint64_t number(std::string_view name, uint64_t fallback) const {
+        auto it = values.find(name);
+        return it == values.end() ? fallback : std::stoull(it->second);
+    }
+    std::string text(std::string_view name, std::string fallback) const {
+        auto it = values.find(name);
+        return it == values.end() ? fallback : it->second;
+    }
+};
+
+// Rounds up to a power of two, so that indices can wrap with a mask
+uint round_up_pow2(uint64_t value) {
+    uint result = 1;
+    while (result < value && result < (uint(1) << 24)) {
+        result <<= 1;
+    }
+    return result;
+}
+
+// Every workload starts by setting r2 to ~0, which is used to count down,
+// and loading a count into r1, which may not fit in 25 bits
+void count_down_from(assembler& a, uint64_t count) {
+    a.nand(2, 0, 0);
+    a.load_constant(1, uint(std::max<uint64_t>(count, 1)), 6);
+}
+// Decrements r1, and jumps to target unless it reached 0
+void loop_back(assembler& a, label target) {
+    a.add(1, 1, 2);
+    a.branch_if_nonzero(1, target, 6, 7);
+}
+void print(assembler& a, std::string_view text, uint reg) {
+    for (char c : text) {
+        a.load_value(reg, uint((unsigned char)c));
+        a.output(reg);
+    }
+}
+
+/**
+ * @brief Arithmetic in a loop, with no memory traffic. Prints a letter that
+ * depends on the result, so that the work can't be skipped
+ *
+ */
+void arith(assembler& a, parameters const& p) {
+    count_down_from(a, p.number("iterations", 1000000));
+    uint unroll = uint(p.number("unroll", 16));
+    a.load_value(3, 12345);
+    a.load_constant(4, 1103515245, 6);
+    a.load_value(5, 7);
+    label loop = a.here();
+    for (uint i = 0; i < unroll; i++) {
+        a.mul(3, 3, 4);
+        a.add(3, 3, 5);
+        a.div(6, 3, 5);
+        a.nand(7, 3, 6);
+        a.add(3, 3, 7);
+    }
+    loop_back(a, loop);
+    a.load_value(6, 15);
+    a.bitwise_and(3, 3, 6);
+    a.load_value(6, 'A');
+    a.add(3, 3, 6);
+    a.output(3);
+    print(a, "\n", 3);
+    a.halt();
+}
+
+/**
+ * @brief Keeps a number of arrays alive (--live), and repeatedly frees one
+ * and allocates another in its place (--count times). Sizes are drawn from a
+ * distribution (--distribution fixed, uniform or log, between --min-size and
+ * --max-size) into a table in the program, which the program cycles through
+ *
+ */
+void alloc_churn(assembler& a, parameters const& p) {
+    constexpr uint table_size = 1024;
+    uint live = round_up_pow2(p.number("live", 1024));
+    uint64_t min_size = p.number("min-size", 1);
+    uint64_t max_size = std::max(p.number("max-size", 64), min_size);
+    std::string distribution = p.text("distribution", "uniform");
+    std::mt19937_64 rng(p.number("seed", 1));
+    std::vector<uint> sizes(table_size);
+    for (uint& size : sizes) {
+        if (distribution == "fixed") {
+            size = uint(min_size);
+        } else if (distribution == "uniform") {
+            size = uint(std::uniform_int_distribution<uint64_t>(
+                min_size,
+                max_size)(rng));
+        } else if (distribution == "log") {
+            // Uniform in the logarithm of the size
+            double low = std::log(double(std::max<uint64_t>(min_size, 1)));
+            double high = std::log(double(max_size) + 1);
+            double x = std::uniform_real_distribution<double>(low, high)(rng);
+            size = uint(std::clamp<uint64_t>(
+                uint64_t(std::exp(x)),
+                min_size,
+                max_size));
+        } else {
+            throw std::invalid_argument(
+                "Unknown distribution '" + distribution + "'");
+        }
+    }
+
+    // r3 is the slot, r4 the array of live identifiers, and r5 the position
+    // in the size table
+    label table = a.new_label();
+    count_down_from(a, p.number("count", 1000000));
+    a.load_constant(6, live, 7);
+    a.alloc(4, 6);
+    a.cmov(3, 6, 6);
+    auto next_size = [&] {
+        // r6 = table[r5 & (table_size - 1)]
+        a.add(5, 5, 2);
+        a.load_value(7, table_size - 1);
+        a.bitwise_and(6, 5, 7);
+        a.load_label(7, table);
+        a.add(6, 6, 7);
+        a.load(6, 0, 6);
+    };
+    label fill = a.here();
+    a.add(3, 3, 2);
+    next_size();
+    a.alloc(7, 6);
+    a.store(4, 3, 7);
+    a.branch_if_nonzero(3, fill, 6, 7);
+
+    label churn = a.here();
+    a.add(3, 3, 2);
+    a.load_constant(7, live - 1, 6);
+    a.bitwise_and(3, 3, 7);
+    a.load(7, 4, 3);
+    a.free(7);
+    next_size();
+    a.alloc(7, 6);
+    a.store(4, 3, 7);
+    loop_back(a, churn);
+    print(a, "ok\n", 3);
+    a.halt();
+
+    a.bind(table);
+    for (uint size : sizes) {
+        a.emit(size);
+    }
+}
+
+/**
+ * @brief Allocates a large number of arrays (--count, of --size words each),
+ * all kept alive, then touches them in a scattered order --accesses times
+ *
+ */
+void live_arrays(assembler& a, parameters const& p) {
+    uint count = round_up_pow2(p.number("count", 1 << 20));
+    uint size = uint(std::max<uint64_t>(p.number("size", 4), 1));
+    uint step = uint(uint64_t(count) * 618 / 1000) | 1;
+
+    // r3 is the index, r4 the array of identifiers, and r5 the step
+    a.nand(2, 0, 0);
+    a.load_constant(3, count, 6);
+    a.alloc(4, 3);
+    label fill = a.here();
+    a.add(3, 3, 2);
+    a.load_constant(6, size, 7);
+    a.alloc(7, 6);
+    a.store(4, 3, 7);
+    a.branch_if_nonzero(3, fill, 6, 7);
+
+    count_down_from(a, p.number("accesses", 10000000));
+    a.load_value(5, step);
+    label access = a.here();
+    a.add(3, 3, 5);
+    a.load_value(6, count - 1);
+    a.bitwise_and(3, 3, 6);
+    a.load(7, 4, 3);
+    a.load(6, 7, 0);
+    a.add(6, 6, 5);
+    a.store(7, 0, 6);
+    loop_back(a, access);
+    print(a, "ok\n", 3);
+    a.halt();
+}
+
+/**
+ * @brief Loads a program of --size words with op 12, --loads times. Two
+ * copies of the program take turns, so that every load replaces array 0.
+ * With --store 1, array 0 is also written to after each load, so that it
+ * stops sharing storage with the copy
+ *
+ */
+void load_program(assembler& a, parameters const& p) {
+    uint size = uint(std::clamp<uint64_t>(
+        p.number("size", 1 << 16),
+        256,
+        assembler::max_value));
+    bool store = p.number("store", 0) != 0;
+
+    // r4 and r5 are the copies. Copy the program into both
+    a.nand(2, 0, 0);
+    a.load_value(3, size);
+    a.alloc(4, 3);
+    a.alloc(5, 3);
+    label copy = a.here();
+    a.add(3, 3, 2);
+    a.load(7, 0, 3);
+    a.store(4, 3, 7);
+    a.store(5, 3, 7);
+    a.branch_if_nonzero(3, copy, 6, 7);
+    count_down_from(a, p.number("loads", 1000));
+
+    label loop = a.here();
+    label done = a.new_label();
+    a.add(1, 1, 2);
+    // Carry on below, unless r1 is 0
+    label reload = a.new_label();
+    a.load_label(6, done);
+    a.load_label(7, reload);
+    a.cmov(6, 7, 1);
+    a.load_program(0, 6);
+    a.bind(reload);
+    if (store) {
+        a.load_value(7, size - 1);
+        a.store(0, 7, 2);
+    }
+    // Swap the copies, and load the one that isn't array 0
+    a.cmov(6, 4, 2);
+    a.cmov(4, 5, 2);
+    a.cmov(5, 6, 2);
+    a.load_label(7, loop);
+    a.load_program(4, 7);
+    a.bind(done);
+    print(a, "ok\n", 3);
+    a.halt();
+    a.pad_to(size);
+}
+
+/**
+ * @brief A loop that rewrites one of its own instructions on every
+ * iteration, --iterations times. The instruction switches between two
+ * opcodes, so anything derived from array 0 has to be updated each time
+ *
+ */
+void self_modify(assembler& a, parameters const& p) {
+    count_down_from(a, p.number("iterations", 1000000));
+    label patched = a.new_label();
+    uint first = assembler::encode_load_value(3, 1);
+    uint second = assembler::encode(3, 3, 3, 3);
+    a.load_constant(4, first, 6);
+    a.load_constant(5, second, 6);
+    label loop = a.here();
+    a.load_label(7, patched);
+    a.store(0, 7, 4);
+    a.cmov(6, 4, 2);
+    a.cmov(4, 5, 2);
+    a.cmov(5, 6, 2);
+    a.bind(patched);
+    a.emit(first);
+    loop_back(a, loop);
+    a.load_value(6, '0');
+    a.add(3, 3, 6);
+    a.output(3);
+    print(a, "\n", 3);
+    a.halt();
+}
+
+/**
+ * @brief Writes --lines lines of 63 letters each
+ *
+ */
+void output_heavy(assembler& a, parameters const& p) {
+    count_down_from(a, p.number("lines", 100000));
+    a.load_value(3, 'x');
+    a.load_value(4, '\n');
+    label loop = a.here();
+    for (int i = 0; i < 63; i++) {
+        a.output(3);
+    }
+    a.output(4);
+    loop_back(a, loop);
+    a.halt();
+}
+
+/**
+ * @brief Reads input until it runs out, then prints a letter that depends
+ * on the sum of the bytes read
+ *
+ */
+void input_heavy(assembler& a, parameters const&) {
+    label loop = a.here();
+    a.input(3);
+    a.add(5, 5, 3);
+    // r3 is ~0 at the end of the input
+    a.nand(4, 3, 3);
+    a.branch_if_nonzero(4, loop, 6, 7);
+    a.load_value(6, 15);
+    a.bitwise_and(5, 5, 6);
+    a.load_value(6, 'A');
+    a.add(5, 5, 6);
+    a.output(5);
+    print(a, "\n", 5);
+    a.halt();
+}
+
+struct workload {
+    std::string_view name;
+    std::string_view options;
+    void (*generate)(assembler&, parameters const&);
+};
+
+constexpr workload workloads[] {
+    {"arith", "--iterations --unroll", arith},
+    {"alloc-churn",
+     "--count --live --distribution --min-size --max-size --seed",
+     alloc_churn},
+    {"live-arrays", "--count --size --accesses", live_arrays},
+    {"load-program", "--size --loads --store", load_program},
+    {"self-modify", "--iterations", self_modify},
+    {"output", "--lines", output_heavy},
+    {"input", "", input_heavy},
+};
+
+void print_usage(char const* program) {
+    fmt::print(
+        stderr,
+        "Usage: \n\n\t{} <workload> <output> [--<option> <value>...]\n\n"
+        "Writes a UM program that exercises one kind of behavior, for "
+        "stress testing\nand benchmarking. Workloads and their "
+        "options:\n\n",
+        program);
+    for (workload const& w : workloads) {
+        fmt::print(stderr, "\t{:<14}{}\n", w.name, w.options);
+    }
+    fmt::print(stderr, "\n");
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fmt::print(stderr, "Missing arguments. ");
+        print_usage(argv[0]);
+        return 0;
+    }
+    std::string_view name = argv[1];
+    parameters p;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        std::string_view option = argv[i];
+        if (option.substr(0, 2) != "--") {
+            fmt::print(stderr, "Expected an option, got '{}'\n", option);
+            return 1;
+        }
+        p.set(std::string(option.substr(2)), argv[i + 1]);
+    }
+    for (workload const& w : workloads) {
+        if (w.name == name) {
+            assembler a;
+            w.generate(a, p);
+            a.write(argv[2]);
+            return 0;
+        }
+    }
+    fmt::print(stderr, "Unknown workload '{}'. ", name);
+    print_usage(argv[0]);
+    return 1;
+}
@@ -21,8 +21,7 @@ int main(int argc, char** argv) {
     // Execute the file as a program if it exists.
     if (fs::exists(filename)) {
 
-        std::vector<uint> instructions = read_words_from_bytes(
-            read_all_bytes(filename));
+        word_array instructions = read_program(filename);
 
         for (uint i : instructions) {
             fmt::print("{}\n", instruction {i});
@@ -0,0 +1,270 @@
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <word_array.hpp>
+
+namespace {
+using compiler::word_array;
+
+/**
+ * @brief Counts what the profiler reports on. Each distinct program that's
+ * loaded into array 0 gets its own count for each position, so that programs
+ * which load other programs don't have their counts mixed together.
+ *
+ */
+struct profiler {
+    struct program_profile {
+        // The program as it was when it was first loaded
+        word_array words;
+        uint64_t loads = 0;
+        uint64_t executed = 0;
+        // How often the instruction at each position was executed
+        std::vector<uint64_t> counts;
+    };
+    // Allocation sizes are counted by bit width: bucket n holds the sizes in
+    // [2^(n-1), 2^n), and bucket 0 holds allocations of 0 words
+    static constexpr unsigned size_buckets = 33;
+
+    // A deque, so that current stays valid as programs are added
+    std::deque<program_profile> programs;
+    // Maps a hash of the words of a program to the program
+    std::unordered_map<size_t, program_profile*> by_hash;
+    program_profile* current = nullptr;
+
+    uint64_t total = 0;
+    uint64_t ops[16] {};
+    // pairs[a][b] counts how often op b was executed right after op a
+    uint64_t pairs[16][16] {};
+    uint32_t last_op = 0;
+    uint64_t jumps = 0;
+    uint64_t loads = 0;
+    uint64_t allocation_sizes[size_buckets] {};
+    uint64_t allocated_words = 0;
+
+    void record(uint32_t pc, uint32_t op) {
+        if (total != 0) {
+            pairs[last_op][op]++;
+        }
+        total++;
+        ops[op]++;
+        last_op = op;
+        current->counts[pc]++;
+        current->executed++;
+    }
+    void record_load(uint32_t index, word_array const& program) {
+        if (index == 0) {
+            jumps++;
+            return;
+        }
+        loads++;
+        select(program);
+    }
+    void record_allocation(uint32_t size) {
+        unsigned bucket = size == 0 ? 0 : 32 - __builtin_clz(size);
+        allocation_sizes[bucket]++;
+        allocated_words += size;
+    }
+
+    // Switches to the counts for the given program, creating them the first
+    // time it's seen
+    void select(word_array const& program) {
+        size_t hash = std::hash<std::string_view> {}(std::string_view(
+            reinterpret_cast<char const*>(program.data()),
+            program.size() * sizeof(uint32_t)));
+        auto it = by_hash.find(hash);
+        if (it != by_hash.end()
+            && std::equal(
+                program.begin(),
+                program.end(),
+                it->second->words.begin(),
+                it->second->words.end())) {
+            current = it->second;
+        } else {
+            current = &programs.emplace_back();
+            current->words = program;
+            // Include the padding word, which a program can run into
+            current->counts.resize(program.size() + 1);
+            by_hash[hash] = current;
+        }
+        current->loads++;
+    }
+};
+
+profiler recorder;
+} // namespace
+
+#define COMPILER_ON_INSTRUCTION(PC, INS) recorder.record(PC, INS.get_OP())
+#define COMPILER_ON_LOAD_PROGRAM(INDEX, PROGRAM)                               \
+    recorder.record_load(INDEX, PROGRAM)
+#define COMPILER_ON_ALLOCATE(SIZE) recorder.record_allocation(SIZE)
+
+#include <algorithm>
+#include <files.hpp>
+#include <fmt/core.h>
+#include <fmt/os.h>
+#include <formatting.hpp>
+
+namespace {
+constexpr char const* op_names[16] {
+    "cmov",
+    "load",
+    "store",
+    "add",
+    "mul",
+    "div",
+    "nand",
+    "halt",
+    "alloc",
+    "free",
+    "output",
+    "input",
+    "load program",
+    "load value",
+    "14",
+    "15"};
+
+double percent(uint64_t count, uint64_t total) {
+    return total == 0 ? 0.0 : 100.0 * double(count) / double(total);
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    namespace fs = std::filesystem;
+    using namespace compiler;
+
+    // Check that a filename was provided as input
+    if (argc < 3) {
+        fmt::print(
+            stderr,
+            "Missing filename. Usage: \n\n\t{} <program> <report> "
+            "[max entries]\n\n"
+            "Runs the program, counting every instruction it executes, and "
+            "writes a\nreport to the report file when it halts. The report "
+            "lists the hottest\npositions of each program loaded into array "
+            "0, along with how often\neach opcode and pair of opcodes was "
+            "executed, op 12 jumps and loads,\nand the sizes of "
+            "allocations. Input and output go through the console\nas "
+            "usual.\n\n",
+            argv[0]);
+        return 0;
+    }
+
+    fs::path filename = argv[1];
+    size_t max_entries = argc > 3 ? std::stoul(argv[3]) : 40;
+
+    if (!fs::exists(filename)) {
+        fmt::print("Couldn't find '{}'\n", filename.c_str());
+        return 1;
+    }
+
+    word_array program = read_program(filename);
+    recorder.select(program);
+    machine m(std::move(program));
+    m.run_loop();
+
+    auto out = fmt::output_file(argv[2]);
+    out.print("# Profile of {}\n", filename.filename().c_str());
+    out.print("instructions {}\n", recorder.total);
+
+    out.print("\n## Opcodes\n");
+    for (uint32_t op = 0; op < 16; op++) {
+        if (recorder.ops[op] != 0) {
+            out.print(
+                "{:>14} {:>6.2f}%  {:>2} {}\n",
+                recorder.ops[op],
+                percent(recorder.ops[op], recorder.total),
+                op,
+                op_names[op]);
+        }
+    }
+
+    struct pair_entry {
+        uint64_t count;
+        uint32_t first;
+        uint32_t second;
+    };
+    std::vector<pair_entry> pairs;
+    for (uint32_t a = 0; a < 16; a++) {
+        for (uint32_t b = 0; b < 16; b++) {
+            if (recorder.pairs[a][b] != 0) {
+                pairs.push_back(pair_entry {recorder.pairs[a][b], a, b});
+            }
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(), [](auto& a, auto& b) {
+        return a.count > b.count;
+    });
+    pairs.resize(std::min(pairs.size(), max_entries));
+    out.print("\n## Opcode pairs\n");
+    for (pair_entry const& e : pairs) {
+        out.print(
+            "{:>14} {:>6.2f}%  {:>2} {:>2}  {}, {}\n",
+            e.count,
+            percent(e.count, recorder.total),
+            e.first,
+            e.second,
+            op_names[e.first],
+            op_names[e.second]);
+    }
+
+    out.print("\n## Op 12\n");
+    out.print("jumps {}\n", recorder.jumps);
+    out.print("loads {}\n", recorder.loads);
+    out.print("distinct programs {}\n", recorder.programs.size());
+
+    out.print("\n## Allocation sizes\n");
+    out.print("allocations {}\n", recorder.ops[8]);
+    out.print("words allocated {}\n", recorder.allocated_words);
+    for (unsigned n = 0; n < profiler::size_buckets; n++) {
+        uint64_t count = recorder.allocation_sizes[n];
+        if (count == 0) {
+            continue;
+        }
+        uint64_t low = n == 0 ? 0 : uint64_t(1) << (n - 1);
+        uint64_t high = n == 0 ? 0 : (uint64_t(1) << n) - 1;
+        out.print(
+            "{:>14} {:>6.2f}%  {}-{} words\n",
+            count,
+            percent(count, recorder.ops[8]),
+            low,
+            high);
+    }
+
+    for (size_t i = 0; i < recorder.programs.size(); i++) {
+        auto const& p = recorder.programs[i];
+        out.print(
+            "\n## Program {}: {} words, loaded {} times, {} instructions "
+            "executed\n",
+            i,
+            p.words.size(),
+            p.loads,
+            p.executed);
+        std::vector<uint32_t> hottest;
+        for (uint32_t pc = 0; pc < p.counts.size(); pc++) {
+            if (p.counts[pc] != 0) {
+                hottest.push_back(pc);
+            }
+        }
+        std::stable_sort(
+            hottest.begin(),
+            hottest.end(),
+            [&](uint32_t a, uint32_t b) {
+                return p.counts[a] > p.counts[b];
+            });
+        hottest.resize(std::min(hottest.size(), max_entries));
+        for (uint32_t pc : hottest) {
+            // The instruction as it was loaded, which may since have been
+            // overwritten
+            uint32_t word = pc < p.words.size() ? p.words[pc] : 0;
+            out.print(
+                "{:>14} {:>6.2f}%  {:>8}  {}\n",
+                p.counts[pc],
+                percent(p.counts[pc], recorder.total),
+                pc,
+                instruction {word});
+        }
+    }
+}
@@ -0,0 +1,368 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <engine.hpp>
+#include <files.hpp>
+#include <fmt/core.h>
+#include <fmt/format.h>
+#include <fmt/os.h>
+#include <formatting.hpp>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+namespace fs = std::filesystem;
+using namespace compiler;
+
+/**
+ * @brief One line of the suite file: a program, the input it's given, and
+ * what it's expected to do with it
+ *
+ */
+struct benchmark_case {
+    std::string name;
+    std::string program;
+    std::string input;
+    // The checksum of the output, and the number of instructions executed
+    uint64_t checksum = 0;
+    uint64_t instructions = 0;
+};
+
+struct statistics {
+    double median = 0;
+    double p95 = 0;
+    double mean = 0;
+    double stddev = 0;
+    // The 95% confidence interval of the mean
+    double ci_low = 0;
+    double ci_high = 0;
+};
+
+// FNV-1a
+uint64_t checksum(std::string_view data) {
+    uint64_t hash = 0xcbf29ce484222325u;
+    for (char c : data) {
+        hash = (hash ^ (unsigned char)c) * 0x100000001b3u;
+    }
+    return hash;
+}
+
+// Inputs are written in the suite file with \n, \t, \\ and \xNN escapes,
+// and - stands for no input
+std::string unescape(std::string_view text) {
+    if (text == "-") {
+        return {};
+    }
+    std::string result;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] != '\\' || i + 1 == text.size()) {
+            result += text[i];
+            continue;
+        }
+        char c = text[++i];
+        if (c == 'n') {
+            result += '\n';
+        } else if (c == 't') {
+            result += '\t';
+        } else if (c == 'x' && i + 2 < text.size()) {
+            std::string hex(text.substr(i + 1, 2));
+            result += char(std::stoi(hex, nullptr, 16));
+            i += 2;
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+std::string escape(std::string_view text) {
+    if (text.empty()) {
+        return "-";
+    }
+    std::string result;
+    for (char c : text) {
+        if (c == '\n') {
+            result += "\\n";
+        } else if (c == '\t') {
+            result += "\\t";
+        } else if (c == '\\') {
+            result += "\\\\";
+        } else if ((unsigned char)c <= ' ' || (unsigned char)c >= 0x7f) {
+            result += fmt::format("\\x{:02x}", (unsigned char)c);
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Reads the suite file. Each line is
+ * `<name> <program> <input> <checksum> <instructions>`, and lines starting
+ * with # are comments
+ *
+ */
+std::vector<benchmark_case> read_suite(fs::path const& filename) {
+    std::ifstream file(filename);
+    if (!file) {
+        throw std::runtime_error(
+            "Couldn't open '" + filename.string() + "'");
+    }
+    std::vector<benchmark_case> suite;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        benchmark_case c;
+        std::string input, sum;
+        fields >> c.name >> c.program >> input >> sum >> c.instructions;
+        if (!fields) {
+            throw std::runtime_error("Malformed line in suite: " + line);
+        }
+        c.input = unescape(input);
+        c.checksum = std::stoull(sum, nullptr, 16);
+        suite.push_back(c);
+    }
+    return suite;
+}
+
+struct run_result {
+    double seconds;
+    std::string output;
+};
+
+run_result run_once(
+    word_array const& program,
+    std::string const& input,
+    engine kind) {
+    auto sink = std::make_shared<string_sink>();
+    machine m(program);
+    m.set_console(console(sink, std::make_shared<string_source>(input)));
+    auto start = std::chrono::steady_clock::now();
+    run(m, kind);
+    auto end = std::chrono::steady_clock::now();
+    m.get_console().flush();
+    return {std::chrono::duration<double>(end - start).count(), sink->str()};
+}
+
+// Two-sided 95% quantiles of Student's t distribution, by degrees of freedom
+double t_quantile(size_t df) {
+    static constexpr double table[] {
+        0,     12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+        2.262, 2.228,  2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110,
+        2.101, 2.093,  2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056,
+        2.052, 2.048,  2.045, 2.042};
+    return df < std::size(table) ? table[df] : 1.96;
+}
+
+statistics summarize(std::vector<double> times) {
+    statistics s;
+    if (times.empty()) {
+        return s;
+    }
+    std::sort(times.begin(), times.end());
+    size_t n = times.size();
+    s.median = n % 2 == 1 ? times[n / 2]
+                          : (times[n / 2 - 1] + times[n / 2]) / 2;
+    // Nearest rank
+    s.p95 = times[size_t(std::ceil(0.95 * double(n))) - 1];
+    for (double t : times) {
+        s.mean += t;
+    }
+    s.mean /= double(n);
+    if (n > 1) {
+        for (double t : times) {
+            s.stddev += (t - s.mean) * (t - s.mean);
+        }
+        s.stddev = std::sqrt(s.stddev / double(n - 1));
+    }
+    double margin = 0;
+    if (n > 1) {
+        margin = t_quantile(n - 1) * s.stddev / std::sqrt(double(n));
+    }
+    s.ci_low = s.mean - margin;
+    s.ci_high = s.mean + margin;
+    return s;
+}
+
+void print_usage(char const* program) {
+    fmt::print(
+        stderr,
+        "Usage: \n\n\t{} [options] [suite]\n\n"
+        "Runs every program in the suite (programs/benchmarks.txt by "
+        "default) on each\navailable engine, checks the output of every "
+        "run against the checksum in\nthe suite, and writes the timings as "
+        "JSON.\n\n"
+        "Options:\n"
+        "\t--repetitions <n>  timed runs of each benchmark (default 5)\n"
+        "\t--warmup <n>       untimed runs before those (default 1)\n"
+        "\t--engine <name>    only run this engine; may be repeated\n"
+        "\t--filter <text>    only run benchmarks whose name contains "
+        "this\n"
+        "\t--output <file>    write the JSON here instead of to standard "
+        "output\n"
+        "\t--record           recompute the checksums and instruction "
+        "counts with the\n"
+        "\t                   switch engine, and rewrite the suite\n\n",
+        program);
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t repetitions = 5;
+    size_t warmup = 1;
+    std::vector<engine> selected;
+    std::string filter;
+    char const* output_arg = nullptr;
+    bool record = false;
+    fs::path suite_path = "programs/benchmarks.txt";
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--repetitions" && i + 1 < argc) {
+            repetitions = std::max<size_t>(std::stoul(argv[++i]), 1);
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            warmup = std::stoul(argv[++i]);
+        } else if (arg == "--engine" && i + 1 < argc) {
+            auto kind = find_engine(argv[++i]);
+            if (!kind) {
+                fmt::print(stderr, "Unknown engine '{}'\n", argv[i]);
+                return 1;
+            }
+            selected.push_back(*kind);
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            output_arg = argv[++i];
+        } else if (arg == "--record") {
+            record = true;
+        } else if (arg == "--help") {
+            print_usage(argv[0]);
+            return 0;
+        } else {
+            suite_path = argv[i];
+        }
+    }
+    if (selected.empty()) {
+        for (engine_info const& info : engines) {
+            if (info.available) {
+                selected.push_back(info.kind);
+            }
+        }
+    }
+
+    std::vector<benchmark_case> suite = read_suite(suite_path);
+    // Programs are relative to the suite file
+    fs::path base = suite_path.parent_path();
+
+    if (record) {
+        std::ofstream out(suite_path);
+        out << "# Benchmarks run by run-benchmarks, one per line:\n"
+            << "# <name> <program> <input> <output checksum> "
+               "<instructions>\n"
+            << "# Programs are relative to this file. Run run-benchmarks "
+               "--record to\n# update the last two columns\n";
+        for (benchmark_case& c : suite) {
+            machine m(read_program(base / c.program));
+            auto sink = std::make_shared<string_sink>();
+            m.set_console(
+                console(sink, std::make_shared<string_source>(c.input)));
+            c.instructions = m.run_loop_for(~uint64_t(0));
+            m.get_console().flush();
+            c.checksum = checksum(sink->str());
+            out << fmt::format(
+                "{} {} {} {:016x} {}\n",
+                c.name,
+                c.program,
+                escape(c.input),
+                c.checksum,
+                c.instructions);
+            fmt::print(stderr, "Recorded {}\n", c.name);
+        }
+        return 0;
+    }
+
+    std::string json;
+    json += "{\n";
+    json += fmt::format(
+        "  \"timestamp\": {},\n  \"compiler\": {},\n  \"repetitions\": {},\n"
+        "  \"warmup\": {},\n  \"results\": [",
+        std::time(nullptr),
+        json_string(__VERSION__),
+        repetitions,
+        warmup);
+    bool first = true;
+    bool all_verified = true;
+    for (benchmark_case const& c : suite) {
+        if (c.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        word_array program = read_program(base / c.program);
+        for (engine kind : selected) {
+            std::string_view engine_name = get_engine_info(kind).name;
+            std::vector<double> times;
+            size_t failures = 0;
+            for (size_t i = 0; i < warmup + repetitions; i++) {
+                run_result r = run_once(program, c.input, kind);
+                if (checksum(r.output) != c.checksum) {
+                    failures++;
+                }
+                if (i >= warmup) {
+                    times.push_back(r.seconds);
+                }
+            }
+            statistics s = summarize(times);
+            double ips = s.median > 0 ? double(c.instructions) / s.median : 0;
+            bool verified = failures == 0;
+            all_verified = all_verified && verified;
+            fmt::print(
+                stderr,
+                "{:<16} {:<10} median {:>11.3f}ms  p95 {:>11.3f}ms  "
+                "{:>8.1f}M instructions/s{}\n",
+                c.name,
+                engine_name,
+                s.median * 1e3,
+                s.p95 * 1e3,
+                ips / 1e6,
+                verified ? "" : "  WRONG OUTPUT");
+
+            json += first ? "\n" : ",\n";
+            first = false;
+            json += fmt::format(
+                "    {{\"benchmark\": {}, \"program\": {}, \"engine\": {}, "
+                "\"instructions\": {}, \"verified\": {}, \"failures\": {},\n"
+                "     \"median\": {}, \"p95\": {}, \"mean\": {}, "
+                "\"stddev\": {}, \"ci95\": [{}, {}],\n"
+                "     \"instructions_per_second\": {}, \"times\": [{}]}}",
+                json_string(c.name),
+                json_string(c.program),
+                json_string(engine_name),
+                c.instructions,
+                verified,
+                failures,
+                s.median,
+                s.p95,
+                s.mean,
+                s.stddev,
+                s.ci_low,
+                s.ci_high,
+                ips,
+                fmt::join(times, ", "));
+        }
+    }
+    json += "\n  ]\n}\n";
+
+    if (output_arg != nullptr) {
+        auto out = fmt::output_file(output_arg);
+        out.print("{}", json);
+    } else {
+        fmt::print("{}", json);
+    }
+    // A fast engine that gets the wrong answer doesn't count
+    return all_verified ? 0 : 2;
+}
@@ -0,0 +1,548 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <files.hpp>
+#include <fmt/core.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__)
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define COMPILER_HAS_EPOLL 1
+#else
+#define COMPILER_HAS_EPOLL 0
+#endif
+
+namespace {
+using namespace compiler;
+using clock_type = std::chrono::steady_clock;
+
+void print_usage(char const* program) {
+    fmt::print(
+        stderr,
+        "Usage: \n\n\t{} [options] <program> <socket>\n\n"
+        "Listens on a Unix-domain socket, and runs a session of the program "
+        "for each\nconnection, with the connection as its input and output. "
+        "Sessions are run a\nslice at a time on a few threads, and a session "
+        "waiting for input takes no\nthread at all. Stop the server with "
+        "SIGINT or SIGTERM.\n\n"
+        "Options:\n"
+        "\t--threads <n>      event loops (default: 2)\n"
+        "\t--slice <n>        instructions a session runs before the next "
+        "one gets a\n\t                   turn (default: 1000000)\n"
+        "\t--memory-limit <MiB>\n\t                   ends sessions whose "
+        "arrays would take up more than\n\t                   this\n"
+        "\t--stats <seconds>  print the open sessions and memory use this "
+        "often\n\n",
+        program);
+}
+
+// Nearest rank
+double percentile(std::vector<double> const& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = size_t(std::ceil(p * double(sorted.size())));
+    return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+#if COMPILER_HAS_EPOLL
+std::atomic<bool> stopping {false};
+
+extern "C" void request_stop(int) { stopping = true; }
+
+size_t resident_bytes() {
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * size_t(sysconf(_SC_PAGESIZE));
+}
+
+/**
+ * @brief Collects the output of a session until the event loop can send it
+ *
+ */
+class pending_sink : public output_sink {
+    std::string& pending;
+
+   public:
+    explicit pending_sink(std::string& pending)
+      : pending(pending) {}
+    void write(char const* data, size_t size) override {
+        pending.append(data, size);
+    }
+};
+
+/**
+ * @brief A connection, and the machine running on its behalf
+ *
+ */
+struct session {
+    int fd;
+    // Output that hasn't been accepted by the socket yet. It's declared before
+    // the machine, whose console flushes into it when it's destroyed
+    std::string pending;
+    size_t sent = 0;
+    std::shared_ptr<queued_source> input = std::make_shared<queued_source>();
+    // Whether the socket is being watched for room to write
+    bool writing = false;
+    bool reading = true;
+    bool queued = false;
+    // When the input that output hasn't been sent for yet arrived
+    clock_type::time_point input_time;
+    bool awaiting_output = false;
+    machine m;
+
+    session(int fd, word_array const& program)
+      : fd(fd)
+      , m(program) {
+        // Sessions are mostly idle, so they get small buffers. run_for()
+        // passes the output on as soon as there's any, so the delay is never
+        // checked
+        m.set_console(console(
+            std::make_shared<pending_sink>(pending),
+            input,
+            console_options {4 << 10, 512, clock_type::duration::zero(), 1}));
+    }
+    session(session const&) = delete;
+    ~session() { close(fd); }
+
+    size_t backlog() const { return pending.size() - sent; }
+};
+
+/**
+ * @brief An event loop, which owns the sessions of the connections it
+ * accepted. Each loop has its own epoll instance and watches the shared
+ * listening socket with EPOLLEXCLUSIVE, so a new connection wakes one loop.
+ * Sessions that are ready to run take turns running a slice of instructions
+ * at a time. Each loop has its own copy of the program, since the reference
+ * counts of arrays aren't atomic; within a loop, every session shares it
+ * until it writes to it
+ *
+ */
+class event_loop {
+    // Sessions aren't run while they have more output than this waiting
+    static constexpr size_t max_backlog = 256 << 10;
+    static constexpr uint64_t listener_id = 0;
+
+    int listener;
+    int epoll = -1;
+    uint64_t slice;
+    // Per session, or 0 for none
+    size_t memory_limit;
+    std::unordered_map<uint64_t, std::unique_ptr<session>> sessions;
+    uint64_t next_id = listener_id + 1;
+    // Sessions ready to run. Closed sessions are skipped when they come up
+    std::deque<uint64_t> runnable;
+    std::vector<double> latencies;
+    size_t served = 0;
+    std::atomic<size_t> open_sessions {0};
+
+    void watch(uint64_t id, session& s) {
+        epoll_event event {};
+        event.events = (s.reading ? uint32_t(EPOLLIN | EPOLLRDHUP) : 0)
+                     | (s.writing ? uint32_t(EPOLLOUT) : 0);
+        event.data.u64 = id;
+        epoll_ctl(epoll, EPOLL_CTL_MOD, s.fd, &event);
+    }
+    void end(uint64_t id) {
+        sessions.erase(id);
+        open_sessions--;
+    }
+    void schedule(uint64_t id, session& s) {
+        if (!s.queued && !s.m.is_halted() && s.backlog() < max_backlog) {
+            s.queued = true;
+            runnable.push_back(id);
+        }
+    }
+
+    void accept_all(word_array const& program) {
+        while (true) {
+            int fd = accept4(
+                listener,
+                nullptr,
+                nullptr,
+                SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                // EAGAIN once there are no more, or another loop got there
+                // first
+                return;
+            }
+            uint64_t id = next_id++;
+            session& s = *sessions.emplace(
+                                       id,
+                                       std::make_unique<session>(fd, program))
+                              .first->second;
+            if (memory_limit != 0) {
+                s.m.set_memory_limit(memory_limit);
+            }
+            epoll_event event {};
+            event.events = EPOLLIN | EPOLLRDHUP;
+            event.data.u64 = id;
+            epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event);
+            served++;
+            open_sessions++;
+            schedule(id, s);
+        }
+    }
+
+    /**
+     * @brief Reads everything available from the socket into the input of
+     * the session
+     *
+     * @return false if the connection failed
+     */
+    bool receive(uint64_t id, session& s) {
+        char buffer[4096];
+        while (true) {
+            ssize_t count = recv(s.fd, buffer, sizeof(buffer), 0);
+            if (count > 0) {
+                if (!s.awaiting_output) {
+                    s.input_time = clock_type::now();
+                    s.awaiting_output = true;
+                }
+                s.input->push(std::string_view(buffer, size_t(count)));
+            } else if (count == 0) {
+                // The client has finished sending, but may still be reading
+                s.input->close();
+                s.reading = false;
+                watch(id, s);
+                break;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else if (errno != EINTR) {
+                return false;
+            }
+        }
+        schedule(id, s);
+        return true;
+    }
+
+    /**
+     * @brief Sends as much of the pending output as the socket takes, and
+     * watches for room to send the rest
+     *
+     * @return false if the connection failed
+     */
+    bool send_pending(uint64_t id, session& s) {
+        while (s.backlog() != 0) {
+            ssize_t count = send(
+                s.fd,
+                s.pending.data() + s.sent,
+                s.backlog(),
+                MSG_NOSIGNAL);
+            if (count > 0) {
+                s.sent += size_t(count);
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else if (errno != EINTR) {
+                return false;
+            }
+        }
+        if (s.backlog() == 0) {
+            // Let go of the memory a burst of output took, so that idle
+            // sessions stay small
+            if (s.pending.capacity() > (64 << 10)) {
+                std::string().swap(s.pending);
+            } else {
+                s.pending.clear();
+            }
+            s.sent = 0;
+        }
+        bool writing = s.backlog() != 0;
+        if (writing != s.writing) {
+            s.writing = writing;
+            watch(id, s);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Runs a slice of the session, and sends what it wrote
+     *
+     * @return false if the session is over
+     */
+    bool run_slice(uint64_t id, session& s) {
+        run_status status;
+        try {
+            status = s.m.run_for(slice);
+        } catch (std::exception const& e) {
+            fmt::print(stderr, "Session failed: {}\n", e.what());
+            return false;
+        }
+        if (s.backlog() != 0 && s.awaiting_output) {
+            latencies.push_back(std::chrono::duration<double>(
+                                    clock_type::now() - s.input_time)
+                                    .count());
+            s.awaiting_output = false;
+        }
+        if (!send_pending(id, s)) {
+            return false;
+        }
+        if (status == run_status::halted) {
+            // Stay open until the rest of the output has been sent
+            return s.backlog() != 0;
+        }
+        if (status != run_status::needs_input) {
+            schedule(id, s);
+        }
+        return true;
+    }
+
+    void handle(uint64_t id, uint32_t events) {
+        auto it = sessions.find(id);
+        if (it == sessions.end()) {
+            return;
+        }
+        session& s = *it->second;
+        bool ok = true;
+        if (events & (EPOLLIN | EPOLLRDHUP)) {
+            ok = receive(id, s);
+        }
+        if (ok && (events & EPOLLOUT)) {
+            ok = send_pending(id, s);
+            if (s.m.is_halted() && s.backlog() == 0) {
+                ok = false;
+            }
+            schedule(id, s);
+        }
+        // Nothing more can be sent once the connection is gone
+        if (!ok || (events & (EPOLLERR | EPOLLHUP))) {
+            end(id);
+        }
+    }
+
+    // Gives each session that's ready to run one slice
+    void run_round() {
+        for (size_t count = runnable.size(); count > 0; count--) {
+            uint64_t id = runnable.front();
+            runnable.pop_front();
+            auto it = sessions.find(id);
+            if (it == sessions.end()) {
+                continue;
+            }
+            it->second->queued = false;
+            if (!run_slice(id, *it->second)) {
+                end(id);
+            }
+        }
+    }
+
+   public:
+    event_loop(int listener, uint64_t slice, size_t memory_limit)
+      : listener(listener)
+      , slice(slice)
+      , memory_limit(memory_limit) {}
+    event_loop(event_loop const&) = delete;
+    ~event_loop() {
+        if (epoll >= 0) {
+            close(epoll);
+        }
+    }
+
+    void run(word_array const& shared_program) {
+        // A copy that belongs to this thread
+        word_array program(shared_program.data(), shared_program.size());
+        epoll = epoll_create1(EPOLL_CLOEXEC);
+        epoll_event event {};
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        event.data.u64 = listener_id;
+        if (epoll < 0
+            || epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event) != 0) {
+            fmt::print(
+                stderr,
+                "Couldn't start an event loop: {}\n",
+                std::strerror(errno));
+            stopping = true;
+            return;
+        }
+
+        epoll_event events[64];
+        while (!stopping) {
+            // Wake up now and then to notice a stop request
+            int count = epoll_wait(
+                epoll,
+                events,
+                std::size(events),
+                runnable.empty() ? 100 : 0);
+            for (int i = 0; i < count; i++) {
+                if (events[i].data.u64 == listener_id) {
+                    accept_all(program);
+                } else {
+                    handle(events[i].data.u64, events[i].events);
+                }
+            }
+            run_round();
+        }
+        sessions.clear();
+        open_sessions = 0;
+    }
+
+    size_t open() const { return open_sessions; }
+    size_t sessions_served() const { return served; }
+    std::vector<double> const& output_latencies() const { return latencies; }
+};
+
+int serve(
+    fs::path const& program_path,
+    std::string const& socket_path,
+    size_t threads,
+    uint64_t slice,
+    size_t memory_limit,
+    unsigned stats_interval) {
+    word_array program = read_program(program_path);
+
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        fmt::print(stderr, "Socket path is too long: {}\n", socket_path);
+        return 1;
+    }
+    std::memcpy(address.sun_path, socket_path.data(), socket_path.size());
+    // A socket left behind by an earlier server
+    std::error_code ec;
+    if (fs::is_socket(socket_path, ec)) {
+        unlink(socket_path.c_str());
+    }
+    int listener
+        = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener < 0
+        || bind(listener, (sockaddr const*)&address, sizeof(address)) != 0
+        || listen(listener, SOMAXCONN) != 0) {
+        fmt::print(
+            stderr,
+            "Couldn't listen on '{}': {}\n",
+            socket_path,
+            std::strerror(errno));
+        return 1;
+    }
+
+    std::signal(SIGINT, request_stop);
+    std::signal(SIGTERM, request_stop);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::vector<std::unique_ptr<event_loop>> loops;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; i++) {
+        loops.push_back(
+            std::make_unique<event_loop>(listener, slice, memory_limit));
+    }
+    size_t baseline = resident_bytes();
+    for (auto& loop : loops) {
+        workers.emplace_back([&loop, &program] { loop->run(program); });
+    }
+    fmt::print(
+        stderr,
+        "Serving {} on {} with {} threads\n",
+        program_path.string(),
+        socket_path,
+        threads);
+
+    auto last_stats = clock_type::now();
+    while (!stopping) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (stats_interval != 0
+            && clock_type::now() - last_stats
+                   >= std::chrono::seconds(stats_interval)) {
+            last_stats = clock_type::now();
+            size_t open = 0;
+            for (auto& loop : loops) {
+                open += loop->open();
+            }
+            size_t resident = resident_bytes();
+            size_t grown = resident > baseline ? resident - baseline : 0;
+            fmt::print(
+                stderr,
+                "{} open sessions, {:.1f} MiB resident, {:.1f} KiB per "
+                "session\n",
+                open,
+                double(resident) / (1 << 20),
+                open == 0 ? 0 : double(grown) / double(open) / 1024);
+        }
+    }
+
+    for (std::thread& t : workers) {
+        t.join();
+    }
+    close(listener);
+    unlink(socket_path.c_str());
+
+    std::vector<double> latencies;
+    size_t served = 0;
+    for (auto& loop : loops) {
+        served += loop->sessions_served();
+        latencies.insert(
+            latencies.end(),
+            loop->output_latencies().begin(),
+            loop->output_latencies().end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    fmt::print(
+        stderr,
+        "{} sessions served\n"
+        "input to output: median {:.3f}ms  p99 {:.3f}ms  max {:.3f}ms\n",
+        served,
+        percentile(latencies, 0.5) * 1e3,
+        percentile(latencies, 0.99) * 1e3,
+        latencies.empty() ? 0 : latencies.back() * 1e3);
+    return 0;
+}
+#endif
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t threads = 2;
+    uint64_t slice = 1000000;
+    size_t memory_limit = 0;
+    unsigned stats_interval = 0;
+    std::vector<char const*> positional;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = std::max<size_t>(std::stoul(argv[++i]), 1);
+        } else if (arg == "--slice" && i + 1 < argc) {
+            slice = std::max<uint64_t>(std::stoull(argv[++i]), 1);
+        } else if (arg == "--memory-limit" && i + 1 < argc) {
+            memory_limit = size_t(std::stoull(argv[++i])) << 20;
+        } else if (arg == "--stats" && i + 1 < argc) {
+            stats_interval = unsigned(std::stoul(argv[++i]));
+        } else if (arg == "--help") {
+            print_usage(argv[0]);
+            return 0;
+        } else {
+            positional.push_back(argv[i]);
+        }
+    }
+    if (positional.size() != 2) {
+        fmt::print(stderr, "Missing program or socket. ");
+        print_usage(argv[0]);
+        return 0;
+    }
+
+#if COMPILER_HAS_EPOLL
+    return serve(
+        positional[0],
+        positional[1],
+        threads,
+        slice,
+        memory_limit,
+        stats_interval);
+#else
+    fmt::print(stderr, "serve requires epoll, which needs Linux\n");
+    return 1;
+#endif
+}
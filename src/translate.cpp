@@ -0,0 +1,243 @@
+#include <aot.hpp>
+#include <files.hpp>
+#include <fmt/core.h>
+#include <fmt/os.h>
+#include <set>
+#include <snapshot.hpp>
+#include <string>
+
+namespace {
+using namespace compiler;
+
+constexpr char const* all_registers = "{r0, r1, r2, r3, r4, r5, r6, r7}";
+
+/**
+ * @brief The C++ statement for the instruction at pc. Statements that leave
+ * the translated code hand the registers to the runtime first
+ *
+ */
+std::string statement(uint pc, instruction i) {
+    uint a = i.get_A(), b = i.get_B(), c = i.get_C();
+    switch (i.get_OP()) {
+        case 0: return fmt::format("if (r{}) r{} = r{};", c, a, b);
+        case 1: return fmt::format("r{} = rt.load(r{}, r{});", a, b, c);
+        case 2:
+            // Writing into the program invalidates the translation
+            return fmt::format(
+                "if (r{0} == 0) {{\n"
+                "        rt.store(0, r{1}, r{2});\n"
+                "        return rt.resume({3}, {4});\n"
+                "    }}\n"
+                "    rt.store(r{0}, r{1}, r{2});",
+                a,
+                b,
+                c,
+                pc + 1,
+                all_registers);
+        case 3: return fmt::format("r{} = r{} + r{};", a, b, c);
+        case 4: return fmt::format("r{} = r{} * r{};", a, b, c);
+        case 5: return fmt::format("r{} = r{} / r{};", a, b, c);
+        case 6: return fmt::format("r{} = ~(r{} & r{});", a, b, c);
+        case 7: return fmt::format("return rt.halt({});", all_registers);
+        case 8: return fmt::format("r{} = rt.allocate(r{});", b, c);
+        case 9: return fmt::format("rt.deallocate(r{});", c);
+        case 10: return fmt::format("rt.output(r{});", c);
+        case 11: return fmt::format("r{} = rt.input();", c);
+        case 12:
+            // So does replacing the program
+            return fmt::format(
+                "if (r{0} != 0 && rt.load_program(r{0})) {{\n"
+                "        return rt.resume(r{1}, {2});\n"
+                "    }}\n"
+                "    pc = r{1};\n"
+                "    goto dispatch;",
+                b,
+                c,
+                all_registers);
+        case 13:
+            return fmt::format(
+                "r{} = {};",
+                i.get_special(),
+                i.get_special_value());
+        default: return ";";
+    }
+}
+
+/**
+ * @brief The positions that get a label. Jumps go through registers, so any
+ * position could be a target, but programs get their targets from op 13.
+ * Every value loaded by op 13 that's inside the program is labeled, along
+ * with the starting position. Jumps anywhere else still work, through
+ * aot_runtime::step()
+ *
+ */
+std::set<uint> jump_targets(std::vector<uint> const& program, uint start) {
+    std::set<uint> targets {start};
+    for (uint word : program) {
+        instruction i {word};
+        if (i.get_OP() == 13 && i.get_special_value() < program.size()) {
+            targets.insert(i.get_special_value());
+        }
+    }
+    return targets;
+}
+
+/**
+ * @brief Writes the translation. Snapshots are restored when the translated
+ * program starts, from the file given on its command line, or else from the
+ * one that was translated
+ *
+ */
+void translate(
+    std::vector<uint> const& program,
+    uint start,
+    fs::path const& source,
+    bool from_snapshot,
+    fmt::ostream& out) {
+    auto size = uint(program.size());
+    std::set<uint> targets = jump_targets(program, start);
+
+    out.print(
+        "// Translated from {} by translate. Build it against the include\n"
+        "// directory of the interpreter, which it uses for arrays and I/O, "
+        "and fmt:\n//\n"
+        "//     c++ -std=c++17 -O2 -I include -I build/generated <this file> "
+        "-lfmt\n\n"
+        "#include <aot.hpp>\n"
+        "#include <iterator>\n{}\n"
+        "namespace {{\n"
+        "using compiler::uint;\n\n"
+        "constexpr uint program[] {{",
+        source.filename().string(),
+        from_snapshot ? "#include <snapshot.hpp>\n" : "");
+    for (uint pc = 0; pc < size; pc++) {
+        out.print("{}{:#010x},", pc % 6 == 0 ? "\n    " : " ", program[pc]);
+    }
+    out.print("}};\n\n");
+
+    // Jumps go through a table with an entry for every position where
+    // computed goto is available, since a switch over targets scattered
+    // through the program tends to become a chain of comparisons
+    out.print(
+        "void run(compiler::aot_runtime& rt) {{\n"
+        "#if COMPILER_HAS_COMPUTED_GOTO\n"
+        "    static void* const labels[] {{");
+    for (uint pc = 0; pc < size; pc++) {
+        out.print(
+            "{}{},",
+            pc % 4 == 0 ? "\n        " : " ",
+            targets.count(pc) != 0 ? fmt::format("&&L{}", pc) : "&&unlabeled");
+    }
+    out.print(
+        "}};\n"
+        "#endif\n"
+        "    compiler::aot_runtime::registers r = rt.get_registers();\n"
+        "    uint r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3];\n"
+        "    uint r4 = r[4], r5 = r[5], r6 = r[6], r7 = r[7];\n"
+        "    uint pc = rt.program_counter();\n"
+        "    if (!rt.runs(program, std::size(program))) {{\n"
+        "        return rt.resume(pc, {0});\n"
+        "    }}\n\n"
+        "dispatch:\n"
+        "#if COMPILER_HAS_COMPUTED_GOTO\n"
+        "    if (pc < std::size(labels)) {{\n"
+        "        goto* labels[pc];\n"
+        "    }}\n"
+        "#else\n"
+        "    switch (pc) {{\n",
+        all_registers);
+    for (uint pc : targets) {
+        out.print("        case {0}: goto L{0};\n", pc);
+    }
+    out.print(
+        "    }}\n"
+        "#endif\n"
+        "unlabeled:\n"
+        "    r = {0};\n"
+        "    if (!rt.step(pc, r)) {{\n"
+        "        return rt.resume(pc, r);\n"
+        "    }}\n"
+        "    r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3];\n"
+        "    r4 = r[4], r5 = r[5], r6 = r[6], r7 = r[7];\n"
+        "    goto dispatch;\n\n",
+        all_registers);
+    for (uint pc = 0; pc < size; pc++) {
+        if (targets.count(pc) != 0) {
+            out.print("L{}:\n", pc);
+        }
+        out.print("    {}\n", statement(pc, instruction {program[pc]}));
+    }
+    // Running off the end is left to the interpreter
+    out.print(
+        "    return rt.resume({}, {});\n}}\n}} // namespace\n\n",
+        size,
+        all_registers);
+
+    if (from_snapshot) {
+        out.print(
+            "int main(int argc, char** argv) {{\n"
+            "    compiler::machine m = compiler::snapshot::restore(\n"
+            "        argc > 1 ? argv[1] : \"{}\");\n",
+            source.string());
+    } else {
+        out.print(
+            "int main() {{\n"
+            "    compiler::machine m(\n"
+            "        compiler::word_array(program, std::size(program)));\n");
+    }
+    out.print(
+        "    compiler::aot_runtime rt(m);\n"
+        "    run(rt);\n"
+        "}}\n");
+}
+
+bool is_snapshot(fs::path const& filename) {
+    char magic[sizeof(snapshot::magic)] {};
+    std::ifstream file(filename, std::ios::binary);
+    file.read(magic, sizeof(magic));
+    return file
+        && std::equal(std::begin(magic), std::end(magic), snapshot::magic);
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    // Check that a filename was provided as input
+    if (argc < 3) {
+        fmt::print(
+            stderr,
+            "Missing filename. Usage: \n\n\t{} <program or snapshot> "
+            "<output.cpp>\n\n"
+            "Translates a UM program into C++, with a statement for each "
+            "instruction in\narray 0. Compiling the result gives an "
+            "executable that runs the program\nnatively, and falls back to "
+            "the interpreter if the program writes into\narray 0 or loads "
+            "another program.\n\n"
+            "Programs that unpack themselves into another program can be "
+            "translated\nfrom a snapshot taken after they've done so (see "
+            "execute --save-after).\nThe translated program restores that "
+            "snapshot when it starts.\n\n",
+            argv[0]);
+        return 0;
+    }
+
+    fs::path filename = argv[1];
+    if (!fs::exists(filename)) {
+        fmt::print("Couldn't find '{}'\n", filename.c_str());
+        return 1;
+    }
+
+    auto out = fmt::output_file(argv[2]);
+    if (is_snapshot(filename)) {
+        machine m = snapshot::restore(filename);
+        if (m.is_halted()) {
+            fmt::print(stderr, "The machine in the snapshot has halted\n");
+            return 1;
+        }
+        aot_runtime rt(m);
+        translate(rt.program(), rt.program_counter(), filename, true, out);
+    } else {
+        std::vector<uint> program
+            = read_words_from_bytes(read_all_bytes(filename));
+        translate(program, 0, filename, false, out);
+    }
+}
@@ -0,0 +1,241 @@
+// Generates superinstructions.hpp from opcode sequence profiles, as written
+// by collect-ngrams. Each profile contributes the share of its instructions
+// that each sequence accounts for, so a long-running program doesn't drown
+// out the others. Sequences are then ranked by the share of dispatches they
+// would save, and the best ones become superinstructions.
+//
+// Usage: gen-superinstructions <output> [profiles...]
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fmt/core.h>
+#include <fmt/format.h>
+#include <fmt/os.h>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+// The longest sequence that can become a superinstruction
+constexpr size_t max_length = 8;
+// Opcode ids 0-15 are reserved for single instructions
+constexpr size_t max_superinstructions = 256 - 16;
+
+// Limits on what gets selected. A sequence has to save at least min_savings
+// of all dispatches in order to be worth a case of its own
+constexpr size_t default_count = 64;
+constexpr double min_savings = 0.0005;
+
+using sequence = std::vector<uint8_t>;
+
+struct candidate {
+    sequence ops;
+    double savings;
+};
+
+// Halts and jumps can only come last, since nothing after them would run.
+// Opcodes 14 and 15 aren't valid instructions
+bool is_valid(sequence const& ops) {
+    for (size_t i = 0; i < ops.size(); i++) {
+        bool last = i + 1 == ops.size();
+        if (ops[i] > 13 || (!last && (ops[i] == 7 || ops[i] == 12))) {
+            return false;
+        }
+    }
+    return ops.size() >= 2 && ops.size() <= max_length;
+}
+
+bool read_profile(
+    std::string const& filename,
+    std::map<sequence, double>& shares) {
+    std::ifstream file(filename);
+    if (!file) {
+        fmt::print(stderr, "Couldn't open '{}'\n", filename);
+        return false;
+    }
+    double total = 0;
+    std::vector<std::pair<sequence, double>> counts;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        if (line.rfind("instructions", 0) == 0) {
+            std::string key;
+            fields >> key >> total;
+            continue;
+        }
+        double count;
+        unsigned op;
+        sequence ops;
+        fields >> count;
+        while (fields >> op) {
+            ops.push_back(uint8_t(op));
+        }
+        counts.emplace_back(ops, count);
+    }
+    if (total <= 0) {
+        fmt::print(
+            stderr,
+            "'{}' is missing its instruction count\n",
+            filename);
+        return false;
+    }
+    for (auto& [ops, count] : counts) {
+        if (is_valid(ops)) {
+            shares[ops] += count / total;
+        }
+    }
+    return true;
+}
+
+std::string op_name(uint8_t op, size_t index) {
+    return fmt::format("OPCODE_{}(i1[{}]);", op, index);
+}
+
+// Writes one line of a multi-line macro, with the backslash in column 80
+void macro_line(fmt::ostream& out, std::string const& text) {
+    out.print("{:<79}\\\n", text);
+}
+
+void write_case(fmt::ostream& out, size_t id, sequence const& ops) {
+    macro_line(out, fmt::format("    case {}:", id));
+    auto line = [&](std::string const& text) {
+        macro_line(out, "        " + text);
+    };
+    line(fmt::format("counter += {};", ops.size()));
+    for (size_t i = 0; i < ops.size(); i++) {
+        size_t remaining = ops.size() - i - 1;
+        switch (ops[i]) {
+            case 2:
+                if (remaining != 0) {
+                    // A store into array 0 may have replaced the rest of
+                    // the sequence, so resume after the store
+                    line(fmt::format(
+                        "if (get_A_register(i1[{}]) == 0) {{",
+                        i));
+                    line(fmt::format("    OPCODE_2(i1[{}]);", i));
+                    line(fmt::format("    counter -= {};", remaining));
+                    line("    break;");
+                    line("}");
+                }
+                line(op_name(2, i));
+                break;
+            case 12:
+                line(fmt::format("LOAD_PROGRAM(i1[{}]);", i));
+                line("sequence_ptr = sequences.data();");
+                break;
+            default: line(op_name(ops[i], i)); break;
+        }
+    }
+    line("break;");
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fmt::print(
+            stderr,
+            "Usage: \n\n\t{} <output> [profiles...]\n\n",
+            argv[0]);
+        return 1;
+    }
+
+    std::map<sequence, double> shares;
+    std::vector<std::string> profiles;
+    for (int i = 2; i < argc; i++) {
+        if (!read_profile(argv[i], shares)) {
+            return 1;
+        }
+        profiles.push_back(argv[i]);
+    }
+
+    // Executing a sequence of n instructions as one saves n - 1 dispatches
+    std::vector<candidate> candidates;
+    for (auto& [ops, share] : shares) {
+        double savings = share * (ops.size() - 1) / profiles.size();
+        if (savings >= min_savings) {
+            candidates.push_back(candidate {ops, savings});
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](auto& a, auto& b) {
+        return a.savings > b.savings;
+    });
+    candidates.resize(std::min(
+        candidates.size(),
+        std::min(default_count, max_superinstructions)));
+
+    // Build a trie over the selected sequences. Node 0 is the root, so a
+    // transition to 0 means there's no match
+    std::vector<std::array<uint16_t, 16>> trie(1);
+    std::vector<uint8_t> accept(1);
+    size_t longest = 1;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        size_t node = 0;
+        for (uint8_t op : candidates[i].ops) {
+            if (trie[node][op] == 0) {
+                trie[node][op] = uint16_t(trie.size());
+                trie.emplace_back();
+                accept.push_back(0);
+            }
+            node = trie[node][op];
+        }
+        accept[node] = uint8_t(16 + i);
+        longest = std::max(longest, candidates[i].ops.size());
+    }
+
+    auto out = fmt::output_file(argv[1]);
+    out.print("// Generated by gen-superinstructions. Do not edit.\n//\n");
+    out.print("// Profiles:\n");
+    for (auto& profile : profiles) {
+        out.print("//   {}\n", profile.substr(profile.find_last_of('/') + 1));
+    }
+    out.print("//\n// Superinstructions (share of dispatches saved):\n");
+    for (size_t i = 0; i < candidates.size(); i++) {
+        out.print("//   {:>3}:", 16 + i);
+        for (uint8_t op : candidates[i].ops) {
+            out.print(" {}", op);
+        }
+        out.print(" ({:.2f}%)\n", candidates[i].savings * 100);
+    }
+    out.print("\n#pragma once\n\n#include <cstddef>\n#include <cstdint>\n\n");
+    out.print("namespace compiler {{\n");
+    out.print(
+        "constexpr size_t superinstruction_max_length = {};\n",
+        longest);
+    out.print(
+        "constexpr size_t superinstruction_count = {};\n\n",
+        candidates.size());
+    out.print(
+        "// Transitions on each opcode. Node 0 is the root, and a transition "
+        "to 0\n// means that no superinstruction continues with that "
+        "opcode\n");
+    out.print(
+        "constexpr uint16_t superinstruction_trie[{}][16] {{\n",
+        trie.size());
+    for (auto& node : trie) {
+        out.print("    {{{}}},\n", fmt::join(node, ", "));
+    }
+    out.print("}};\n\n");
+    out.print(
+        "// The id of the superinstruction that ends at each node, or 0 if "
+        "none does\n");
+    out.print(
+        "constexpr uint8_t superinstruction_accept[{}] {{{}}};\n",
+        accept.size(),
+        fmt::join(accept, ", "));
+    out.print("}} // namespace compiler\n\n");
+
+    out.print(
+        "// Cases for run_loop_superinstructions(). Each one runs a whole "
+        "sequence of\n// instructions, starting at i1[0]\n");
+    macro_line(out, "#define SUPERINSTRUCTION_CASES");
+    for (size_t i = 0; i < candidates.size(); i++) {
+        write_case(out, 16 + i, candidates[i].ops);
+    }
+    out.print("\n");
+}